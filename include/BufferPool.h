@@ -0,0 +1,71 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Core.h"
+
+#define NETLINK_BUFFER_POOL_BLOCK_SIZE (2*1024*1024)
+
+namespace netLink {
+
+    /*! Hands out buffers of one size from a free list.
+     Buffers are carved out of large blocks, which can be backed by huge pages (Linux), and are never freed before the pool.
+     */
+    class BufferPool {
+        //! Allocation which is split into buffers
+        struct Block {
+            char* memory; //!< Start of the allocation
+            size_t size; //!< Size of the allocation in bytes
+            bool mapped; //!< Allocated by mmap instead of new
+        };
+
+        std::vector<Block> blocks; //!< All allocations
+        std::vector<char*> freeBuffers; //!< Buffers which are not borrowed
+        size_t bufferSize; //!< Size of each buffer in bytes
+        size_t borrowed; //!< Number of buffers which are borrowed
+        bool hugePages; //!< Try to back new blocks by huge pages
+
+        //! Allocates a new block and adds its buffers to the free list
+        void grow();
+
+        public:
+        /*! Initializes an empty pool
+         @param bufferSize Size of each buffer in bytes
+         @param hugePages Back the blocks by huge pages if the system has some reserved (falls back to normal pages)
+         @throws Exception::ERROR_INIT if bufferSize is 0
+         */
+        BufferPool(size_t bufferSize = NETLINK_DEFAULT_INPUT_BUFFER_SIZE, bool hugePages = false);
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+        ~BufferPool();
+
+        //! Returns a buffer of getBufferSize() bytes
+        char* acquire();
+        //! Returns a buffer of acquire() to the pool
+        void release(char* buffer);
+
+        //! Returns the size of each buffer in bytes
+        size_t getBufferSize() const { return bufferSize; }
+        //! Returns the number of buffers which are borrowed
+        size_t getBorrowed() const { return borrowed; }
+        //! Returns the number of bytes allocated for buffers
+        size_t getAllocated() const;
+    };
+
+};
@@ -36,6 +36,7 @@ namespace MsgPack {
         std::unique_ptr<Element> copy() const;
         void toJSON(std::ostream& stream) const;
         uint32_t getSizeInBytes() const;
+        uint32_t getStreamedChildren() const;
         std::vector<std::unique_ptr<Element>>* getElementsVector();
         //! Returns the entry at the index or nullptr if out of bounds
         Element* getEntry(uint32_t index) const;
@@ -56,6 +57,7 @@ namespace MsgPack {
         std::unique_ptr<Element> copy() const;
         void toJSON(std::ostream& stream) const;
         uint32_t getSizeInBytes() const;
+        uint32_t getStreamedChildren() const;
         std::vector<std::unique_ptr<Element>>* getElementsVector();
         /*! Generates a map of the element vector
          * @warning Life time of return value depends on this object
@@ -35,6 +35,7 @@ namespace MsgPack {
         std::unique_ptr<Element> copy() const;
         void toJSON(std::ostream& stream) const;
         uint32_t getSizeInBytes() const;
+        uint32_t getStreamedChildren() const;
         //! Returns the count of elements in the container
         uint32_t getLength() const;
     };
@@ -52,6 +53,7 @@ namespace MsgPack {
         std::unique_ptr<Element> copy() const;
         void toJSON(std::ostream& stream) const;
         uint32_t getSizeInBytes() const;
+        uint32_t getStreamedChildren() const;
         //! Returns the count of elements in the container
         uint32_t getLength() const;
     };
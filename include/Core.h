@@ -31,13 +31,34 @@
 #include <sys/fcntl.h>
 #include <netdb.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
-#include <set>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <sys/mman.h>
+#endif
+#include <deque>
+#include <algorithm>
+#include <cerrno>
 #include <cmath>
+#include <chrono>
 
 #define NETLINK_DEFAULT_INPUT_BUFFER_SIZE 8192
 #define NETLINK_DEFAULT_OUTPUT_BUFFER_SIZE 8192
+#define NETLINK_MAX_POLL_EVENTS 256
+#define NETLINK_DEFAULT_ACCEPT_BATCH_SIZE 64
+#define NETLINK_MAX_DATAGRAM_BATCH_SIZE 64
+#define NETLINK_MAX_OUTPUT_REFERENCES 256
+#define NETLINK_SPLICE_SIZE 65536
+#define NETLINK_MIN_RING_BUFFER_SIZE 65536
+#define NETLINK_BUFFER_GROW_COUNT 4
+#define NETLINK_BUFFER_SHRINK_DELAY 1.0
+#define NETLINK_CONNECT_ATTEMPT_DELAY 0.25
+#define NETLINK_POOL_MAINTAIN_INTERVAL 1.0
+#define NETLINK_MSGPACK_PRIORITY_LANES 4
 
 namespace netLink {
 
@@ -30,6 +30,7 @@ namespace MsgPack {
         std::unique_ptr<char[]> data; //!< The raw data buffer
         std::streamsize serialize(int64_t& pos, std::basic_streambuf<char>* streamBuffer, std::streamsize bytes);
         std::streamsize deserialize(int64_t& pos, std::basic_streambuf<char>* streamBuffer, std::streamsize bytes);
+        const char* getBody() const { return data.get(); };
     };
 
     //! MsgPack::Data to represent binary/raw data elements
@@ -116,6 +116,8 @@ namespace MsgPack {
         virtual std::vector<std::unique_ptr<Element>>* getElementsVector() { return NULL; };
         //! Returns the first invalid (de)serializer position
         virtual int64_t getEndPos() const = 0;
+        //! Returns the body which is serialized after the header (from position 0 to getEndPos()) or NULL
+        virtual const char* getBody() const { return NULL; };
         public:
         virtual ~Element() { }
         //! Creates a deep copy of this element
@@ -126,6 +128,8 @@ namespace MsgPack {
         virtual Type getType() const = 0;
         //! Returns the size in bytes this MsgPack::Element takes if completely serialized
         virtual uint32_t getSizeInBytes() const { return static_cast<uint32_t>(getEndPos()); };
+        //! Returns the count of elements which follow in the stream as children of this one (only a lone container header has some)
+        virtual uint32_t getStreamedChildren() const { return 0; };
     };
 
 };
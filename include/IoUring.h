@@ -0,0 +1,72 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Core.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace netLink {
+
+    /*! Minimal io_uring submission and completion queue pair (Linux only)
+     The SocketManager only submits poll requests, so it is a readiness poller like epoll:
+     Interest changes are batched into the wait instead of costing an epoll_ctl each,
+     but accept, recv and send are still separate system calls.
+     */
+    class IoUring {
+        int handle; //!< Handle of the ring
+        void* sqRing; //!< Mapping of the submission queue ring
+        void* cqRing; //!< Mapping of the completion queue ring
+        size_t sqRingSize, //!< Size of the submission queue ring mapping
+               cqRingSize, //!< Size of the completion queue ring mapping
+               sqesSize; //!< Size of the submission queue entries mapping
+        unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+        unsigned int *cqHead, *cqTail, *cqMask;
+        struct io_uring_sqe* sqes; //!< Submission queue entries
+        struct io_uring_cqe* cqes; //!< Completion queue entries
+        unsigned int sqPending; //!< Number of prepared but not yet submitted entries
+
+        public:
+        //! Callback which is called for every completion with its user data, result and flags
+        typedef std::function<void(uint64_t userData, int32_t result, uint32_t flags)> CompletionCallback;
+
+        /*! Sets up the ring
+         @param entries Minimal number of submission queue entries
+         */
+        IoUring(unsigned int entries);
+        IoUring(const IoUring&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+        ~IoUring();
+
+        /*! Returns a zeroed submission queue entry to be filled in
+         @warning Submits all prepared entries first if the submission queue is full
+         */
+        struct io_uring_sqe* getSqe();
+        /*! Submits all prepared entries and optionally waits for completions with a single system call
+         @param waitUpToSeconds Maximum time to wait for a completion in seconds, 0.0 to not wait at all or negative values to wait indefinitely
+         */
+        void enter(double waitUpToSeconds = 0.0);
+        /*! Consumes all available completions
+         @param callback Called once per completion
+         */
+        void complete(const CompletionCallback& callback);
+    };
+
+};
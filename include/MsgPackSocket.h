@@ -31,21 +31,81 @@ namespace netLink {
         std::shared_ptr<Socket> SocketFactory() {
             return std::shared_ptr<Socket>(new MsgPackSocket());
         }
+        //! Deserializes the received data and passes the elements on to SocketManager::onReceiveMsgPack
+        void onReadable();
+        //! Serializes the queues, highest priority first, and sends as much as possible
+        void onWritable();
+        bool hasPendingOutput();
+        //! Frees the elements whose bodies were sent by reference
+        void releaseOutput();
+        size_t queuedBytes; //!< Serialized size of the elements in the queues
+        size_t serializingBytes; //!< Bytes of the elements taken by the serializer which it did not write yet
+        size_t highWatermark; //!< Unsent bytes at which backpressure starts or 0 for an unbounded queue
+        size_t lowWatermark; //!< Unsent bytes at which backpressure ends again
+        bool backpressure; //!< The queue exceeded the high watermark and did not drain to the low watermark yet
+        int openLane; //!< Lane of the last element taken by the serializer
+        size_t openChildren; //!< Elements the streamed containers (ArrayHeader, MapHeader) of openLane still expect
 
         public:
-        std::queue<std::unique_ptr<MsgPack::Element>> queue; //!< Internal queue of elements to be serialized and sent
+        //! Queue of the default priority which pushes through send (kept for compatibility)
+        class DefaultQueue {
+            MsgPackSocket* socket;
+            public:
+            DefaultQueue(MsgPackSocket* _socket) :socket(_socket) { }
+            DefaultQueue(const DefaultQueue&) = delete;
+            DefaultQueue& operator=(const DefaultQueue&) = delete;
+            //! Same as MsgPackSocket::send with the default priority
+            void push(std::unique_ptr<MsgPack::Element> element) { socket->send(std::move(element)); }
+            //! Returns the number of elements in queues[0]
+            size_t size() const { return socket->queues[0].size(); }
+            //! Returns true if queues[0] is empty
+            bool empty() const { return socket->queues[0].empty(); }
+        };
+
+        std::queue<std::unique_ptr<MsgPack::Element>> queues[NETLINK_MSGPACK_PRIORITY_LANES]; //!< Internal queues of elements to be serialized and sent by priority (use send or trySend to push)
+        DefaultQueue queue; //!< Queue of the default priority (kept for compatibility)
         MsgPack::Serializer serializer; //!< Internal MsgPack serializer
         MsgPack::Deserializer deserializer; //!< Internal MsgPack deserializer
 
-        MsgPackSocket() :Socket(), serializer(this), deserializer(this) { };
+        MsgPackSocket() :Socket(), queuedBytes(0), serializingBytes(0), highWatermark(0), lowWatermark(0), backpressure(false), openLane(0), openChildren(0), queue(this), serializer(this), deserializer(this) { };
+
+        /*! Sends bodies of String, Binary and Extended elements from the elements themselves (writev)
+            instead of copying them into the output intermediate buffer, together with the other queued elements
+         @param bytes Minimum size of a body to be sent this way or 0 to always copy
+         @pre Type needs to be TCP_CLIENT or TCP_SERVERS_CLIENT
+         */
+        void setGatherThreshold(std::streamsize bytes);
+
+        /*! Bounds the output by the bytes which are not sent yet (see getQueuedBytes).
+         SocketManager::onBackpressure is called once they reach highWatermark and again once they were sent down to lowWatermark.
+         @param highWatermark Unsent bytes at which backpressure starts or 0 for an unbounded queue (default)
+         @param lowWatermark Unsent bytes at which backpressure ends again (at most highWatermark)
+         */
+        void setQueueLimit(size_t highWatermark, size_t lowWatermark);
+        //! Returns the bytes which are not sent yet: queued elements, the rest of the element in serialization and the output
+        size_t getQueuedBytes();
+        //! Returns true if the unsent bytes reached the high watermark and were not sent down to the low watermark yet
+        bool hasBackpressure() const { return backpressure; }
 
-        /*! Pushes one MsgPack::Element in the queue.
+        /*! Pushes one MsgPack::Element in a queue, even if there is backpressure.
+         Between two elements the one with the highest priority is sent next, elements of the same priority keep their order.
+         @param element pointer containing the element
+         @param priority Priority lane from 0 (default) to NETLINK_MSGPACK_PRIORITY_LANES-1 (highest)
+         */
+        void send(std::unique_ptr<MsgPack::Element> element, unsigned int priority = 0);
+        /*! Pushes one MsgPack::Element in the queue with the default priority, even if there is backpressure.
          @param element pointer containing the element
          */
         MsgPackSocket& operator<<(std::unique_ptr<MsgPack::Element> element) {
-            queue.push(std::move(element));
+            send(std::move(element));
             return *this;
         }
+        /*! Pushes one MsgPack::Element in a queue unless there is backpressure
+         @param element pointer containing the element, left untouched if it was not pushed
+         @param priority Priority lane (see send)
+         @return False if the element was not pushed
+         */
+        bool trySend(std::unique_ptr<MsgPack::Element>& element, unsigned int priority = 0);
     };
 
 };
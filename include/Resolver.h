@@ -0,0 +1,119 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Socket.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+
+#define NETLINK_RESOLVER_THREADS 4
+#define NETLINK_RESOLVER_CACHE_TIME 60.0
+#define NETLINK_RESOLVER_CACHE_SIZE 1024
+#define NETLINK_RESOLVER_POLL_INTERVAL 0.01
+
+namespace netLink {
+
+    /*! Resolves host names on a few background threads and keeps the results for a limited time.
+     The callbacks are called from complete(), which the SocketManager calls in listen().
+     @warning Apart from the background threads it must only be used from the thread of its SocketManager
+     */
+    class Resolver {
+        public:
+        //! Called with the resolved addresses or an empty list if resolving failed
+        typedef std::function<void(const std::vector<Endpoint>& addresses)> Callback;
+
+        private:
+        //! Resolved addresses and until when they may be used
+        struct CacheEntry {
+            std::vector<Endpoint> addresses;
+            std::chrono::steady_clock::time_point expiry;
+        };
+        //! Parameters of getaddrinfo for a background thread
+        struct Query {
+            std::string key, host;
+            unsigned int port;
+            int family, socktype;
+        };
+
+        std::unordered_map<std::string, CacheEntry> cache; //!< Resolved addresses by query
+        std::unordered_map<std::string, std::vector<Callback>> waiting; //!< Callbacks of the queries in progress
+        std::mutex mutex; //!< Guards queries, results, idleThreads and stopping
+        std::condition_variable condition; //!< Wakes the background threads if there are queries or they have to stop
+        std::deque<Query> queries; //!< Queries which no background thread took yet
+        std::vector<std::pair<std::string, std::vector<Endpoint>>> results; //!< Resolved queries whose callbacks were not called yet
+        std::vector<std::thread> threads; //!< Background threads, started on demand
+        unsigned int idleThreads; //!< Number of background threads waiting for queries
+        bool stopping; //!< Background threads have to stop
+        int wakeupHandle; //!< Becomes readable if there are results (eventfd on Linux) or -1
+
+        //! Returns the key of a query in cache and waiting
+        static std::string getKey(const std::string& host, unsigned int port, int family, int socktype);
+        //! Inserts resolved addresses into the cache
+        void store(const std::string& key, const std::vector<Endpoint>& addresses);
+        //! Main loop of the background threads
+        void work();
+
+        public:
+        double cacheTime; //!< Seconds resolved addresses are used again without resolving them (0.0 disables the cache)
+        unsigned int maxThreads; //!< Maximum number of background threads
+
+        Resolver();
+        Resolver(const Resolver&) = delete;
+        Resolver& operator=(const Resolver&) = delete;
+        //! Waits for the background threads to finish their current query
+        ~Resolver();
+
+        /*! Resolves a host on the calling thread (getaddrinfo)
+         @param host Host name or numeric address, NULL for the wildcard address
+         @param port The port
+         @param family AF_INET, AF_INET6 or AF_UNSPEC
+         @param socktype SOCK_STREAM or SOCK_DGRAM
+         @param passive Returns addresses to bind to instead of to connect to
+         @return The addresses in order of preference, empty if resolving failed
+         */
+        static std::vector<Endpoint> query(const char* host, unsigned int port, int family, int socktype, bool passive = false);
+        //! Returns true if host is a numeric IPv4 or IPv6 address, which resolves without asking anyone
+        static bool isNumeric(const std::string& host);
+
+        /*! Looks up addresses which were resolved less than cacheTime ago
+         @return True if addresses were found
+         */
+        bool lookup(const std::string& host, unsigned int port, int family, int socktype, std::vector<Endpoint>& addresses);
+        /*! Resolves a host using the cache, the calling thread waits for it on a cache miss
+         @throws Exception::ERROR_RESOLVING_ADDRESS if resolving failed
+         */
+        std::vector<Endpoint> resolve(const std::string& host, unsigned int port, int family, int socktype);
+        /*! Resolves a host on a background thread without looking into the cache.
+         Concurrent requests of the same host share one query.
+         @param callback Called from complete() once the host is resolved
+         */
+        void resolve(const std::string& host, unsigned int port, int family, int socktype, Callback callback);
+        //! Stores the results of the background threads in the cache and calls their callbacks
+        void complete();
+        //! Returns true if there are queries in progress
+        bool isPending() const { return !waiting.empty(); }
+        //! Returns a handle which becomes readable if complete() has to be called or -1 if there is none
+        int getWakeupHandle() const { return wakeupHandle; }
+        //! Removes all resolved addresses
+        void clearCache() { cache.clear(); }
+    };
+
+};
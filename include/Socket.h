@@ -18,25 +18,84 @@
 
 #pragma once
 
-#include "Core.h"
+#include "BufferPool.h"
 
 namespace netLink {
 
     class SocketManager;
+    class Socket;
+
+    //! Binary address of a remote host, which can be used for many datagrams (see Socket::sendTo)
+    class Endpoint {
+        friend class Socket;
+        friend class Resolver;
+        struct sockaddr_storage address; //!< The resolved address
+        socklen_t addressLength; //!< Length of address or 0 if it is not resolved
+
+        public:
+        Endpoint() :addressLength(0) { }
+        //! Returns true if the endpoint holds a resolved address
+        bool isValid() const { return addressLength != 0; }
+        //! Returns the numeric host string of the address (formatted on every call)
+        std::string getHost() const;
+        //! Returns the port of the address
+        unsigned int getPort() const;
+        //! Returns the address for the system interface
+        const struct sockaddr* getAddress() const { return reinterpret_cast<const struct sockaddr*>(&address); }
+        //! Returns the length of the address in bytes
+        socklen_t getAddressLength() const { return addressLength; }
+        //! Compares family, host and port of the addresses
+        bool operator==(const Endpoint& other) const;
+        bool operator!=(const Endpoint& other) const { return !(*this == other); }
+        //! Returns a hash of family, host and port of the address
+        size_t hash() const;
+    };
+
+    /*! Unordered set of sockets, stored densely in a vector.
+     Every socket remembers its set and its index there, so insert, erase and count are O(1) and iterating does not copy any std::shared_ptr.
+     @warning Erasing moves the last socket into the gap, which invalidates iterators
+     @warning A socket which is in several sets at once is only found in O(1) by the first one, the others search it
+     */
+    class SocketSet {
+        friend class SocketManager;
+        std::vector<std::shared_ptr<Socket>> items; //!< The sockets in no particular order
+        SocketManager* manager; //!< Manager which polls the sockets of this set (SocketManager::sockets) or NULL
+        //! Returns the index of socket in items or items.size() if it is not contained
+        size_t indexOf(const Socket* socket) const;
+
+        public:
+        typedef std::vector<std::shared_ptr<Socket>>::const_iterator const_iterator;
+
+        SocketSet() :manager(NULL) { }
+        SocketSet(const SocketSet& other);
+        SocketSet& operator=(const SocketSet& other);
+        ~SocketSet();
+
+        typedef const_iterator iterator;
+
+        const_iterator begin() const { return items.begin(); }
+        const_iterator end() const { return items.end(); }
+        size_t size() const { return items.size(); }
+        bool empty() const { return items.empty(); }
+        //! Returns 1 if socket is contained else 0
+        size_t count(const std::shared_ptr<Socket>& socket) const;
+        //! Inserts socket if it is not contained yet
+        void insert(const std::shared_ptr<Socket>& socket);
+        //! Removes socket if it is contained
+        void erase(const std::shared_ptr<Socket>& socket);
+        //! Removes all sockets
+        void clear();
+    };
 
     //! Socket and stream buffer
-    class Socket : public std::streambuf {
+    class Socket : public std::streambuf, public std::enable_shared_from_this<Socket> {
         typedef std::streambuf super; //!< Typedef of super class
         friend class SocketManager;
+        friend class SocketSet;
+        friend class ConnectionPool;
 
-        struct AddrinfoDestructor {
-            AddrinfoDestructor() { };
-            void operator() (struct addrinfo* res) const {
-                freeaddrinfo(res);
-            }
-        };
-        typedef std::unique_ptr<struct addrinfo, AddrinfoDestructor> AddrinfoContainer;
-        AddrinfoContainer getSocketInfoFor(const char* host, unsigned int port, bool wildcardAddress);
+        //! Resolves a host for the type and IPVersion of the socket (remote hosts through the cache of the manager)
+        std::vector<Endpoint> getSocketInfoFor(const char* host, unsigned int port, bool wildcardAddress);
 
         //Buffer management and positioning
         pos_type seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out);
@@ -45,17 +104,36 @@ namespace netLink {
 
         //Input functions (get)
         std::streamsize inputIntermediateSize;
+        char_type* inputIntermediateBuffer; //!< Allocation of the input intermediate buffer (the get area might point elsewhere)
+        bool inputMirrored; //!< Input intermediate buffer is a ring buffer which is mapped twice in a row
+        bool inputPooled; //!< Input intermediate buffer is borrowed from bufferPool while it holds data
         std::streamsize xsgetn(char_type* buffer, std::streamsize size);
         int_type underflow();
 
         //Output functions (put)
+        std::streamsize outputIntermediateSize;
+        char_type* outputIntermediateBuffer; //!< Allocation of the output intermediate buffer (the put area moves along if it is mirrored)
+        bool outputMirrored; //!< Output intermediate buffer is a ring buffer which is mapped twice in a row
+        bool outputPooled; //!< Output intermediate buffer is borrowed from bufferPool while it holds data
+        std::shared_ptr<BufferPool> bufferPool; //!< Pool of the intermediate buffers of the pools size or NULL
+        //! Borrows the input intermediate buffer from bufferPool if it is pooled and not borrowed yet
+        void borrowInputBuffer();
+        //! Borrows the output intermediate buffer from bufferPool if it is pooled and not borrowed yet
+        void borrowOutputBuffer();
+        //! Returns pooled intermediate buffers which are empty to bufferPool
+        void returnIdleBuffers();
         std::streamsize xsputn(const char_type* buffer, std::streamsize size);
         int_type overflow(int_type c = -1);
+        //! Removes bytes which were sent from the beginning of the put area
+        void consumeOutput(std::streamsize bytes);
+        //! Ends the put area at the pending output while no flush is scheduled, so that the next write calls overflow() which schedules one
+        void fitPutArea();
 
         /*! Shifts the remaining data to the beginning of the input intermediate buffer
             and fills up the input intermediate buffer by receiving data (TCP)
             or writes the next received packet at the beginning of the input intermediate buffer (UDP)
-         @return Size of the read packet or 0 on error
+         @return Number of bytes in the input intermediate buffer or 0 if there is nothing (UDP)
+         @throws Exception::ERROR_READ if the connection was closed or broke
          @pre The input intermediate buffer must be used
          */
         std::streamsize advanceInputBuffer();
@@ -91,23 +169,135 @@ namespace netLink {
         Type type; //!< Type of the socket
         unsigned int status; //!< Or listen queue size if socket is TCP_SERVER
         int handle; //!< Handle used for the system interface
+        SocketManager* manager; //!< SocketManager which polls this socket or NULL
+        bool flushScheduled; //!< Socket is waiting to be flushed by its manager
+        uint32_t pollSlot; //!< Slot in the interest set of the manager
+        SocketSet* set; //!< SocketSet which contains this socket and owns setIndex or NULL
+        size_t setIndex; //!< Index in set
+        size_t setCount; //!< Number of SocketSets which contain this socket
+        Endpoint remoteEndpoint; //!< Address of the sender of the last datagram or of hostRemote and portRemote (UDP)
+        std::string remoteEndpointHost; //!< Value of hostRemote when remoteEndpoint was resolved or formatted
+        unsigned int remoteEndpointPort; //!< Value of portRemote when remoteEndpoint was resolved or formatted
+        bool remoteFormatted; //!< remoteEndpointHost and remoteEndpointPort were formatted from remoteEndpoint
+        bool remoteConnected; //!< UDP_PEER is connected to remoteEndpoint
+        unsigned int datagramBatchSize; //!< Number of datagrams received per system call (UDP)
+        std::vector<char_type> datagramBuffers; //!< Packet buffers of a batch, each as large as the input intermediate buffer
+        std::vector<Endpoint> datagramSenders; //!< Senders of the packets in a batch
+        std::vector<char_type> queuedDatagrams; //!< Payloads of the queued datagrams, one after another
+        std::vector<std::pair<Endpoint, std::streamsize>> queuedDestinations; //!< Destinations and sizes of the queued datagrams
+        size_t queuedSent; //!< Number of queued datagrams which were sent already
+        bool receiveOffload; //!< Kernel may coalesce received datagrams (UDP GRO)
+        unsigned int receiveSegmentSize; //!< Segment size of the coalesced datagram currently read or 0
+        //! Data which is sent from where it is instead of being copied into the output intermediate buffer
+        struct OutputReference {
+            std::streamsize offset; //!< Number of bytes in the output intermediate buffer which are sent before
+            const char_type* data; //!< Referenced data, must stay valid until it is sent
+            std::streamsize size; //!< Size of the referenced data in bytes
+        };
+        std::vector<OutputReference> outputReferences; //!< Referenced data which is not sent yet, in order
+        std::streamsize zeroCopyThreshold; //!< Minimum size of referenced data to be sent without copying or 0
+        uint32_t zeroCopySent, //!< Number of zero copy sends
+                 zeroCopyCompleted; //!< Number of zero copy sends which the system does not use anymore
+        int splicePipe[2]; //!< Pipe of redirected data which is sent before the output intermediate buffer or -1 (Linux)
+        std::streamsize splicePending; //!< Number of bytes in splicePipe
+        std::weak_ptr<Socket> spliceSource; //!< Socket which waits for splicePipe to be sent to redirect more
+        bool receivePaused; //!< Manager does not poll for readability while the redirected data waits in the pipe of a destination
+        double connectTimeout, //!< Seconds a nonblocking connect may take or 0.0
+               idleTimeout; //!< Seconds without activity until the socket times out or 0.0
+        uint64_t timeoutTimer; //!< Timer of the connect or idle timeout in the manager
+        uint64_t lastActivity; //!< Tick of the last event of the socket in the manager
+        std::streamsize adaptiveMinSize, //!< Size the intermediate buffers shrink back to
+                        adaptiveMaxSize; //!< Size the intermediate buffers grow up to or 0 if they are fixed
+        unsigned int inputFullCount, //!< Number of consecutive receives which filled the input intermediate buffer
+                     outputFullCount; //!< Number of consecutive sends of a full output intermediate buffer
+        uint64_t shrinkTimer; //!< Timer which shrinks the grown intermediate buffers in the manager
+        /*! Shrinks the intermediate buffers to adaptiveMinSize, unless their contents do not fit
+         @return True if one of them is still larger than adaptiveMinSize
+         */
+        bool shrinkBuffers();
+        bool resolving; //!< TCP_CLIENT waits for the resolver of the manager, it has no handle yet
+        Socket* attemptOf; //!< TCP_CLIENT whose nonblocking connect this socket races or NULL
+        std::vector<Endpoint> connectCandidates; //!< Addresses which the nonblocking connect did not try yet, in order (TCP_CLIENT)
+        std::vector<std::shared_ptr<Socket>> connectAttempts; //!< Connects to further addresses which race the handle
+        uint64_t attemptTimer; //!< Timer which starts the next connect attempt in the manager
+        uint64_t connectStart; //!< Tick when the nonblocking connect started in the manager, the connect timeout covers all attempts
         /*! Initzialize system handle
          @param blocking Waits for connection if true
         */
         void initSocket(bool blocking);
+        /*! Creates the system handle for the first of addresses which works
+         @param addresses Candidates to connect to (TCP_CLIENT) or to bind to
+         @param blocking Waits for connection if true
+         */
+        void openSocket(const std::vector<Endpoint>& addresses, bool blocking);
+        /*! Replaces the handle of a failed or superseded nonblocking connect (called by SocketManager)
+         @param attempt Connect attempt which hands over its handle or NULL to connect to the next of connectCandidates
+         @throws Exception::ERROR_INIT if no address is left
+         */
+        void replaceHandle(Socket* attempt);
+        //! Returns and clears the pending error of the handle (SO_ERROR)
+        int takeError();
+        //! Makes sender the remote of a UDP_PEER, formats hostRemote and portRemote only if it changed
+        void setDatagramSender(const Endpoint& sender);
+        //! Lets the manager send the output in its next listen (called when new output is written)
+        void flushLater();
+        //! Called by the SocketManager after new data was received, passes it on to SocketManager::onReceiveRaw
+        virtual void onReadable();
+        //! Called by the SocketManager if the socket can send, sends as much of the output as possible
+        virtual void onWritable();
+        //! Returns true if there is output which was not sent yet
+        virtual bool hasPendingOutput();
+        /*! Receives a batch of datagrams and passes them on to onReadable() one by one
+         @return Number of received datagrams
+         @throws Exception::ERROR_READ if receiving failed
+         */
+        std::streamsize receiveDatagrams();
+        //! Sends as many queued datagrams as possible, the ones which fail are dropped
+        void sendDatagrams();
+        /*! Appends data to the output by reference (it is sent in order with the output intermediate buffer)
+         @return size or 0 if no more references can be taken until the output is sent
+         @pre Type needs to be TCP_CLIENT or TCP_SERVERS_CLIENT and the output intermediate buffer must be used
+         */
+        std::streamsize referenceOutput(const char_type* data, std::streamsize size);
+        /*! Sends the output intermediate buffer and the referenced data with as few system calls as possible (writev)
+         @return Number of bytes which were sent
+         @throws Exception::ERROR_SEND if sending failed
+         */
+        std::streamsize sendGathered();
+        //! Reads the completions of zero copy sends from the error queue and calls releaseOutput() once all are done
+        void readZeroCopyCompletions();
+        //! Called once all referenced output was sent and is not used by the system anymore
+        virtual void releaseOutput() { };
+        /*! Sends the data in splicePipe
+         @return Number of bytes which are left in splicePipe
+         @throws Exception::ERROR_SEND if sending failed
+         */
+        std::streamsize sendSplicePipe();
+        /*! Moves received data to destination inside the system (splice on Linux) until either side would block.
+            If the pipe of the destination is full, onReadable() is called again once it was sent.
+         @return Number of bytes which were moved
+         @pre Both need to be TCP_CLIENT or TCP_SERVERS_CLIENT and the output intermediate buffer of the destination must be empty
+         */
+        std::streamsize spliceTo(Socket* destination);
         //! Generates new sockets for client connections of a server
         virtual std::shared_ptr<Socket> SocketFactory() {
             return std::shared_ptr<Socket>(new Socket());
         }
 
         public:
-        std::set<std::shared_ptr<Socket>> clients; //!< Client sockets of a server
+        SocketSet clients; //!< Client sockets of a server
         std::string hostLocal, //!< Host string of local
-                    hostRemote; //!< Host string of remote
+                    hostRemote; //!< Host string of remote (for a UDP_PEER the sender of the last received datagram, assign it to send elsewhere)
         unsigned int portLocal, //!< Port of local
-                     portRemote; //!< Port of remote
+                     portRemote; //!< Port of remote (for a UDP_PEER the sender of the last received datagram)
 
         /*! Setup socket as TCP client
+         If it is not waiting and has a SocketManager, the host is resolved in the background unless it is numeric or cached.
+         Until then it has no handle and the connect timeout does not start yet.
+         If resolving fails SocketManager::onStatusChange reports NOT_CONNECTED.
+         If the host has several addresses, the SocketManager races connects to them (Happy Eyeballs, RFC 8305):
+         Every NETLINK_CONNECT_ATTEMPT_DELAY seconds or when a connect fails the next address is tried, alternating IPv6 and IPv4.
+         The first one to connect becomes the handle and the others are closed.
          @param hostRemote The remote host to connect to
          @param portRemote The remote port to connect to
          @param waitUntilConnected Set blocking mode until connected
@@ -148,24 +338,90 @@ namespace netLink {
         //! Returns the SocketStatus of the socket
         Status getStatus() const;
 
+        //! Returns hostRemote (for a UDP_PEER the sender of the last received datagram)
+        const std::string& getHostRemote() const;
+        //! Returns portRemote (for a UDP_PEER the sender of the last received datagram)
+        unsigned int getPortRemote() const;
+        //! Returns the binary address of the remote (for a UDP_PEER the sender of the last received datagram)
+        const Endpoint& getRemoteEndpoint() const;
+
         /*! Returns only the number of outstanding bytes to be received from the system cache
          @return Number of bytes in the system cache, not including iostream buffers
          @warning Use in_avail() instead if you are interested in the total number of bytes which can be read
         */
         std::streamsize showmanyc();
-        /*! Receives size bytes into buffer
-         @return The actual number of bytes which were received
+        /*! Receives up to size bytes into buffer
+         @return The actual number of bytes which were received (0 if there is nothing to receive at the moment)
+         @throws Exception::ERROR_READ if the connection was closed or broke
          @pre Type must not be TCP_SERVER and status must be READY or BUSY
          @warning In most cases you don't want to call this directly but use the iostream API instead (see wiki)
         */
         std::streamsize receive(char_type* buffer, std::streamsize size);
         /*! Sends size bytes from buffer
-         @return The actual number of bytes which were sent
+         @return The actual number of bytes which were sent (status becomes BUSY if not all of them)
          @pre Type must not be TCP_SERVER and status must be READY
          @warning In most cases you don't want to call this directly but use the iostream API instead (see wiki)
         */
         std::streamsize send(const char_type* buffer, std::streamsize size);
+        /*! Resolves a remote host once, so that sending to it does not need to resolve it again
+         @param hostRemote The remote host
+         @param portRemote The remote port
+         @return The resolved binary address matching the IPVersion of the socket
+         @pre Type needs to be UDP_PEER
+         */
+        Endpoint resolve(const std::string& hostRemote, unsigned portRemote);
+        /*! Sends size bytes from buffer as one datagram to endpoint
+         @return The actual number of bytes which were sent (0 if the socket is BUSY)
+         @pre Type needs to be UDP_PEER and status must be READY or BUSY
+         @warning This bypasses the output intermediate buffer
+         */
+        std::streamsize sendTo(const Endpoint& endpoint, const char_type* buffer, std::streamsize size);
+        /*! Queues one datagram for endpoint, the SocketManager sends all queued datagrams at once (sendmmsg on Linux)
+         @pre Type needs to be UDP_PEER
+         */
+        void queueDatagram(const Endpoint& endpoint, const char_type* buffer, std::streamsize size);
+        /*! Sets how many datagrams the SocketManager receives at once (recvmmsg on Linux).
+         The callbacks are still called once per datagram, while the socket reads from its packet.
+         @param count Number of datagrams, each up to the size of the input intermediate buffer (1 disables batching)
+         @pre Type needs to be UDP_PEER
+         */
+        void setDatagramBatchSize(unsigned int count);
+        /*! Lets the kernel split each datagram which is sent larger than segmentSize into datagrams of segmentSize (UDP GSO on Linux).
+         A single send can carry up to 64 segments this way, only the last one may be shorter.
+         @param segmentSize Size of the datagrams on the wire (0 disables segmentation)
+         @pre Type needs to be UDP_PEER
+         @throws Exception::ERROR_SET_SOCK_OPT if the system does not support it
+         */
+        void setSegmentationOffload(unsigned int segmentSize);
+        /*! Sends referenced output (see MsgPackSocket::setGatherThreshold) of at least bytes without copying it (MSG_ZEROCOPY on Linux).
+            The referenced data is kept until the system reports that it does not use it anymore.
+            If the system copies anyway (e.g. on loopback) zero copy is turned off again.
+         @param bytes Minimum size of the referenced data or 0 to always copy
+         @pre Type needs to be TCP_CLIENT or TCP_SERVERS_CLIENT
+         @throws Exception::ERROR_SET_SOCK_OPT if the system does not support it
+         */
+        void setZeroCopyThreshold(std::streamsize bytes);
+        /*! Lets the kernel coalesce received datagrams of the same sender (UDP GRO on Linux).
+         They are split into their segments again before the callbacks are called, one per segment.
+         The input intermediate buffer is enlarged to hold a coalesced datagram.
+         @pre Type needs to be UDP_PEER
+         @throws Exception::ERROR_SET_SOCK_OPT if the system does not support it
+         */
+        void setReceiveOffload(bool enable);
+        //! Returns the segment size of the coalesced datagram currently read or 0 if it was not coalesced
+        unsigned int getReceiveSegmentSize() const {
+            return receiveSegmentSize;
+        }
+        /*! Connects a UDP_PEER to a fixed remote.
+         Then only datagrams from there are received and sending does not pass an address to the system.
+         @param hostRemote The remote host
+         @param portRemote The remote port
+         @pre Type needs to be UDP_PEER
+         */
+        void connectUdpPeer(const std::string& hostRemote, unsigned portRemote);
         /*! Redirects received data to all Sockets in destinations
+            A single TCP destination gets the data without copying it through user space (splice on Linux),
+            if it can not send the rest stays in the system and the callback is called again when it can.
          @param destinations A list of destinations to sent the data to
          @return The actual number of bytes which were redirected
          @warning If one destination can't handle the outgoing load, a Expection is thrown and all other destinations get out of sync (data loss)
@@ -176,10 +432,29 @@ namespace netLink {
         std::streamsize getInputBufferSize();
         //! Get the size of the output intermediate buffer in bytes
         std::streamsize getOutputBufferSize();
-        //! Set the size of the input intermediate buffer in bytes (unread contents are lost)
+        //! Get the number of bytes in the output intermediate buffer which were not sent yet
+        std::streamsize getOutputBufferPending();
+        //! Set the size of the input intermediate buffer in bytes (unread contents are kept and it does not get smaller than them, 0 drops them)
         void setInputBufferSize(std::streamsize size);
-        //! Set the size of the output intermediate buffer in bytes (unwritten contents are lost)
+        //! Set the size of the output intermediate buffer in bytes (unsent contents are kept and it does not get smaller than them, 0 drops them)
         void setOutputBufferSize(std::streamsize size);
+        /*! Lets the intermediate buffers adapt to the traffic.
+            A buffer doubles after NETLINK_BUFFER_GROW_COUNT consecutive receives or sends which used all of it
+            and the SocketManager shrinks it back after NETLINK_BUFFER_SHRINK_DELAY seconds without activity.
+         @param minSize Size the buffers start with and shrink back to
+         @param maxSize Size the buffers grow up to or 0 to keep them fixed (clients of a TCP_SERVER inherit both)
+         @pre Type needs to be TCP_CLIENT, TCP_SERVER or TCP_SERVERS_CLIENT
+         */
+        void setAdaptiveBufferSize(std::streamsize minSize, std::streamsize maxSize);
+
+        /*! Sets the time a nonblocking connect may take until SocketManager::onTimeout is called
+         @param seconds Timeout in seconds or 0.0 to disable it
+         */
+        void setConnectTimeout(double seconds);
+        /*! Sets the time without incoming or outgoing data until SocketManager::onTimeout is called
+         @param seconds Timeout in seconds or 0.0 to disable it (clients of a TCP_SERVER inherit it)
+         */
+        void setIdleTimeout(double seconds);
 
         /*! Updates the blocking mode of the socket.
          A socket will be non blocking by default.
@@ -204,8 +479,16 @@ namespace netLink {
         std::shared_ptr<Socket> accept();
         //! Disconnects the socket, deletes the intermediate buffers and sets the handle to -1
         void disconnect();
-        //! Check if there is a problem with this socket and disconnect in case there is one
+        //! Check if there is a problem with this socket and disconnect in case there is one (costs a system call, SocketManager only calls it if the poller reports a problem)
         void disconnectOnError();
     };
 
 };
+
+namespace std {
+    template<> struct hash<netLink::Endpoint> {
+        size_t operator()(const netLink::Endpoint& endpoint) const {
+            return endpoint.hash();
+        }
+    };
+};
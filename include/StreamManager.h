@@ -36,12 +36,25 @@ namespace MsgPack {
     //! Used to serialize elements into a std::streambuf
     class Serializer : public StreamManager {
         typedef std::function<std::unique_ptr<Element>()> PullCallback; //!< Typedef of callback to get the next element to be serialized
+        typedef std::function<std::streamsize(const char* body, std::streamsize size)> ReferenceCallback; //!< Typedef of callback to take a body by reference
+        std::vector<std::unique_ptr<Element>> referencedElements; //!< Serialized elements whose bodies are still referenced
+        bool rootReferenced; //!< A body of the root element was referenced
         public:
+        /*! Called instead of copying bodies of at least referenceThreshold bytes into the streamBuffer (optional).
+         Returns how many bytes of the body it took, 0 stops the serialization like a full streamBuffer.
+         The body stays valid until releaseReferences() is called.
+         */
+        ReferenceCallback referenceBody;
+        std::streamsize referenceThreshold; //!< Minimum size of a body in bytes to be passed to referenceBody
         /*! Constructs the Serializer
          @param _streamBuffer A std::streambuf to be used as target for read operations
          */
         Serializer(std::streambuf* _streamBuffer)
-            : StreamManager(_streamBuffer) { }
+            : StreamManager(_streamBuffer), rootReferenced(false), referenceThreshold(0) { }
+        //! Frees the serialized elements whose bodies were passed to referenceBody, call it once they are not used anymore
+        void releaseReferences() {
+            referencedElements.clear();
+        }
         /*! Pulls elements and writes them into the streamBuffer
          @param pullElement Callback which will be called to get the next element
          @param bytes Limit of bytes to write or 0 to write as much as possible
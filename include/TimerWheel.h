@@ -0,0 +1,85 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Core.h"
+
+#define NETLINK_TIMER_WHEEL_LEVELS 11
+#define NETLINK_TIMER_WHEEL_SLOTS 64
+
+namespace netLink {
+
+    /*! Hierarchical timer wheel with O(1) schedule and cancel.
+     Time is measured in ticks, each level covers 64 times the range of the level below (all 64 bits in total).
+     */
+    class TimerWheel {
+        public:
+        //! Callback of an expired timer
+        typedef std::function<void()> Callback;
+
+        private:
+        //! Slot in the timer slab
+        struct Timer {
+            uint64_t expiry; //!< Tick at which the timer expires
+            uint32_t prev, next; //!< Neighbours in the list of the timer
+            uint32_t generation; //!< Distinguishes ids of a reused slot, 0 if the slot is free
+            uint32_t list; //!< Index of the list the timer is in
+            Callback callback; //!< Called when the timer expires
+        };
+
+        std::vector<Timer> timers; //!< Slab of all timers
+        std::vector<uint32_t> freeTimers; //!< Slots which can be reused
+        std::vector<uint32_t> passed; //!< Timers collected during advance
+        uint32_t lists[NETLINK_TIMER_WHEEL_LEVELS*NETLINK_TIMER_WHEEL_SLOTS+1]; //!< First timer of every slot, the last one holds expired timers
+        uint64_t occupied[NETLINK_TIMER_WHEEL_LEVELS]; //!< Bitmap of non empty slots per level
+        uint64_t current; //!< The current tick
+        uint32_t generation; //!< Generation of the last scheduled timer
+        size_t count; //!< Number of scheduled timers
+
+        //! Inserts a timer into the list matching its expiry
+        void link(uint32_t index);
+        //! Removes a timer from its list
+        void unlink(uint32_t index);
+
+        public:
+        /*! Initializes an empty wheel
+         @param now The current tick
+         */
+        TimerWheel(uint64_t now = 0);
+
+        //! Returns the current tick
+        uint64_t getCurrent() const { return current; }
+        //! Returns true if no timers are scheduled
+        bool empty() const { return count == 0; }
+        /*! Schedules a callback
+         @param expiry Tick at which the callback will be called
+         @return An id to cancel the timer (never 0)
+         */
+        uint64_t schedule(uint64_t expiry, Callback callback);
+        /*! Cancels a timer
+         @return False if the timer did expire or was canceled already
+         */
+        bool cancel(uint64_t id);
+        //! Returns the tick of the next expiry (might be earlier but never later) or UINT64_MAX if empty
+        uint64_t nextExpiry() const;
+        //! Advances the wheel to now and calls the callbacks of all expired timers
+        void advance(uint64_t now);
+    };
+
+};
@@ -19,32 +19,278 @@
 #pragma once
 
 #include "MsgPackSocket.h"
+#include "Resolver.h"
+#include "IoUring.h"
+#include "TimerWheel.h"
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <unordered_map>
 
 namespace netLink {
 
     //! Manages a group of Sockets
     class SocketManager {
+        friend class Socket;
+        friend class SocketSet;
+
+        //! Kinds of readiness a socket can be polled for
+        enum Interest {
+            READABLE = 1, //!< Socket has incoming data, a pending connection or an error
+            WRITABLE = 2, //!< Socket can send (again) or finished a nonblocking connect
+            FAILED = 4 //!< Socket reported an error or hang up (only as event, never registered)
+        };
+
+        //! Slot of a socket in the interest set
+        struct Watch {
+            std::shared_ptr<Socket> socket; //!< The polled socket
+            std::weak_ptr<Socket> server; //!< TCP_SERVER which accepted the socket or empty
+            unsigned int interest; //!< Registered Interest flags
+            uint32_t generation; //!< Distinguishes events of a reused slot, 0 if the slot is free or released
+            bool armed; //!< A poll request is in flight (io_uring only)
+        };
+
+        std::deque<Watch> watched; //!< Slot table of all polled sockets (references stay valid while growing)
+        std::vector<uint32_t> freeSlots; //!< Slots which can be reused
+        std::vector<uint32_t> released; //!< Slots of sockets which were disconnected since the last listen
+        std::vector<std::shared_ptr<Socket>> releasedUnwatched; //!< Sockets without slot which were disconnected while resolving or failed to initialize
+        std::vector<uint64_t> pending; //!< Tokens of sockets which got new output since the last listen
+        std::vector<std::pair<uint64_t, unsigned int>> readyEvents; //!< Reused buffer of polled events
+        std::vector<uint64_t> disarmed; //!< Tokens of completed poll requests to be armed again (io_uring only)
+        size_t watchedCount; //!< Number of sockets in the interest set
+        #ifdef __linux__
+        int pollHandle; //!< epoll instance holding the interest set
+        #endif
+        IoUring* ring; //!< Replaces the epoll instance for readiness polling if built with NETLINK_IO_URING
+        uint32_t generation; //!< Generation of the last watched socket
+        TimerWheel timers; //!< Timers and socket timeouts in milliseconds
+        bool wakeupArmed; //!< A poll request for the wakeup handle of resolver is in flight (io_uring only)
+
+        //! Returns the slot of a token (slot and generation) or NULL if it is outdated
+        Watch* getWatch(uint64_t token);
+        //! Returns the slot of a socket or NULL if it is not in the interest set
+        Watch* getWatch(Socket* socket);
+        //! Inserts a socket into the interest set (called by Socket at init and accept)
+        void watch(std::shared_ptr<Socket> socket, Socket* server);
+        //! Removes a socket from the interest set (called by Socket at disconnect)
+        void unwatch(Socket* socket);
+        //! Polls a socket which was inserted into sockets if it is initialized already (called by SocketSet)
+        void adopt(const std::shared_ptr<Socket>& socket);
+        //! Stops polling a socket which was erased from sockets (called by SocketSet)
+        void abandon(const std::shared_ptr<Socket>& socket);
+        //! Removes a socket without slot from sockets in the next listen (called by Socket at disconnect or if init fails)
+        void releaseUnwatched(Socket* socket);
+        //! Updates the registered Interest flags of a socket
+        void setInterest(Watch& entry, unsigned int interest);
+        //! Sends the output of a socket and polls it for writability only as long as some of it remains
+        void flush(const std::shared_ptr<Socket>& socket);
+        //! Schedules a socket to be flushed in the next listen (called by Socket)
+        void markPending(Socket* socket);
+        //! Stops or resumes polling a socket for readability (called by Socket while a redirect waits for its destination)
+        void pauseReceiving(Socket* socket, bool paused);
+        //! Schedules the connect or idle timeout of a socket again (called by Socket if they change)
+        void updateTimeout(Socket* socket);
+        //! Handles the timeout of a socket, which might have been postponed by activity
+        void expireTimeout(uint64_t token);
+        /*! Schedules shrinking the grown intermediate buffers of a socket (called by Socket when they grow)
+         @param expiry Tick to shrink at or 0 for NETLINK_BUFFER_SHRINK_DELAY after the last activity
+         */
+        void scheduleShrink(Socket* socket, uint64_t expiry = 0);
+        //! Shrinks the grown intermediate buffers of a socket if it was idle, which might have been postponed by activity
+        void expireShrink(uint64_t token);
+        //! Schedules the next connect attempt of a socket which has addresses left
+        void scheduleAttempt(Socket* socket);
+        /*! Starts a connect to the next address of a socket, which races its handle
+         @return False if there is no address left
+         */
+        bool startAttempt(Socket* socket);
+        //! Handles an event of a connect attempt, the first one which connects becomes the handle of its socket
+        void settleAttempt(std::shared_ptr<Socket> attempt, unsigned int events);
+        //! Replaces the handle of a socket whose connect failed by another attempt or the next address
+        void failover(const std::shared_ptr<Socket>& socket);
+        //! Closes all connect attempts of a socket (called by Socket at disconnect)
+        void cancelAttempts(Socket* socket);
+        //! Submits a one shot poll request for a socket (io_uring only)
+        void armPoll(Watch& entry);
+        //! Removes released sockets from sockets and their servers clients
+        void releaseSockets();
+        //! Waits for readiness of the interest set and writes the tokens and their Interest flags into events
+        void poll(double waitUpToSeconds, std::vector<std::pair<uint64_t, unsigned int>>& events);
+
         public:
         //! Event which is called if a TCP_SERVER accepts a new connection (if false is returned the connection will be closed immediately)
         std::function<bool(SocketManager* manager, std::shared_ptr<Socket> serverSocket, std::shared_ptr<Socket> clientSocket)> onConnectRequest;
         //! Event which is called if a socket can or can not send more data (also called if nonblocking connect succeeded)
         std::function<void(SocketManager* manager, std::shared_ptr<Socket> socket, Socket::Status prev)> onStatusChange;
+        //! Event which is called if a socket did not connect or was idle in time (if false is returned or there is no callback the socket will be disconnected)
+        std::function<bool(SocketManager* manager, std::shared_ptr<Socket> socket)> onTimeout;
         //! Event which is called if a socket receives new raw data
         std::function<void(SocketManager* manager, std::shared_ptr<Socket> socket)> onReceiveRaw;
         //! Event which is called if a socket receives a MsgPack::Element
         std::function<void(SocketManager* manager, std::shared_ptr<Socket> socket, std::unique_ptr<MsgPack::Element> element)> onReceiveMsgPack;
-        //! Sockets which are managed
-        std::set<std::shared_ptr<Socket>> sockets;
+        //! Event which is called if the queue of a MsgPackSocket reaches its high watermark (true) and once it drained to its low watermark (false, see MsgPackSocket::setQueueLimit)
+        std::function<void(SocketManager* manager, std::shared_ptr<Socket> socket, bool backpressure)> onBackpressure;
+        /*! Sockets which are managed, the manager polls exactly these and the clients of their servers.
+         Inserting an initialized socket polls it and erasing one stops polling it.
+         Sockets which are disconnected or fail to initialize are removed in the next listen.
+         */
+        SocketSet sockets;
+        //! Maximum number of connections a TCP_SERVER accepts per listen
+        unsigned int acceptBatchSize;
+        /*! Pool for the intermediate buffers of new sockets or NULL (default).
+         Buffers of the pools size are only borrowed while they hold data, so idle sockets take no buffer memory.
+         */
+        std::shared_ptr<BufferPool> bufferPool;
+        /*! Resolves the remote hosts of sockets and caches them (see Socket::initAsTcpClient).
+         Sockets which connect without waiting are resolved in the background and connect from within listen.
+         */
+        Resolver resolver;
 
-        //! Allocates a new Socket, inserts it into sockets and returns it
-        std::shared_ptr<Socket> newSocket();
+        SocketManager();
+        SocketManager(const SocketManager&) = delete;
+        SocketManager& operator=(const SocketManager&) = delete;
+        ~SocketManager();
+
+        /*! Allocates a new Socket, inserts it into sockets and returns it
+         @param SocketClass Socket or a subclass which implements its own protocol (see Socket::onReadable)
+         */
+        template<class SocketClass = Socket>
+        std::shared_ptr<Socket> newSocket() {
+            std::shared_ptr<Socket> socket(new SocketClass());
+            socket->manager = this;
+            socket->bufferPool = bufferPool;
+            sockets.insert(socket);
+            return socket;
+        }
         //! Allocates a new MsgPackSocket, inserts it into sockets and returns it
         std::shared_ptr<Socket> newMsgPackSocket();
 
+        /*! Calls a callback once after a delay (from within listen)
+         @param seconds Delay in seconds (millisecond resolution)
+         @return An id to cancel the timer
+         */
+        uint64_t setTimer(double seconds, std::function<void(SocketManager* manager)> callback);
+        /*! Cancels a timer
+         @return False if the timer was called or canceled already
+         */
+        bool cancelTimer(uint64_t timer);
+
         /*! Listens a periode time
-         @param waitUpToSeconds Maximum time to wait for incoming data in seconds or negative values to wait indefinitely
+         @param waitUpToSeconds Maximum time to wait for incoming data in seconds or negative values to wait indefinitely (returns earlier if a timer expires)
          */
         void listen(double waitUpToSeconds = 0.0);
     };
 
+    /*! Runs one SocketManager per thread (reactor)
+     @warning A SocketManager, its sockets and callbacks must only be used from its own thread while running
+     */
+    class SocketManagerGroup {
+        std::vector<std::thread> threads; //!< One thread per manager while running
+        std::atomic<bool> running; //!< Threads keep listening while true
+        std::vector<std::exception_ptr> errors; //!< First exception each thread caught from listen() since start()
+
+        public:
+        //! The reactors, set their callbacks before calling start()
+        std::vector<std::unique_ptr<SocketManager>> managers;
+
+        /*! Allocates the managers
+         @param count Number of managers (one per core by default)
+         */
+        SocketManagerGroup(unsigned count = std::thread::hardware_concurrency());
+        SocketManagerGroup(const SocketManagerGroup&) = delete;
+        SocketManagerGroup& operator=(const SocketManagerGroup&) = delete;
+        ~SocketManagerGroup();
+
+        /*! Setup a TCP server in every manager, all bound to the same port.
+         Relies on SO_REUSEPORT, so that the system distributes incoming connections between them.
+         @param hostLocal The host to be listening to (see Socket::initAsTcpServer)
+         @param portLocal The local port or 0 to let the system choose one for all servers
+         @param msgPack Uses newMsgPackSocket() instead of newSocket() if true
+         @param listenQueue Queue size for outstanding sockets to accept per server
+         @return The TCP_SERVER sockets in the order of managers
+         */
+        std::vector<std::shared_ptr<Socket>> initAsTcpServers(const std::string& hostLocal, unsigned portLocal, bool msgPack = false, unsigned listenQueue = 16);
+
+        /*! Starts one thread per manager which calls listen() until stop() is called.
+         An exception thrown by listen() (e.g. by a callback) is caught and the thread keeps listening.
+         @param waitUpToSeconds Maximum time a thread waits in listen(), bounds the latency of stop()
+         */
+        void start(double waitUpToSeconds = 0.1);
+        /*! Stops and joins all threads
+         @throws The first exception a thread caught from listen() since start()
+         */
+        void stop();
+    };
+
+    /*! Keeps connected TCP clients per destination (host and port) to be leased again instead of connecting each time.
+     Idle connections stay in the SocketManager, so their events still reach its callbacks.
+     @warning The SocketManager must outlive the pool and both must only be used from the thread of the manager
+     */
+    class ConnectionPool {
+        //! Connections of one destination
+        struct Destination {
+            std::string host;
+            unsigned int port;
+            std::deque<std::pair<std::shared_ptr<Socket>, std::chrono::steady_clock::time_point>> idle; //!< Idle connections and since when, the most recently returned last
+            unsigned int leased; //!< Number of connections which were leased and not returned yet
+        };
+
+        std::unordered_map<std::string, Destination> destinations; //!< Destinations by host and port
+        std::unordered_map<Socket*, std::pair<std::weak_ptr<Socket>, std::string>> leases; //!< Leased connections and their destination
+        uint64_t maintainTimer; //!< Timer which calls maintain() periodically
+
+        //! Returns true if an idle connection can be leased (still connecting or connected without unread data), only uses what the manager already polled
+        static bool isHealthy(const std::shared_ptr<Socket>& socket);
+        //! Allocates and connects a new socket to a destination
+        std::shared_ptr<Socket> connect(Destination& destination);
+        //! Returns the destination of a host and port, inserting it if it is new
+        Destination& getDestination(const std::string& host, unsigned int port);
+        //! Closes broken and expired idle connections and opens new ones up to minSize
+        void maintain();
+
+        public:
+        SocketManager* manager; //!< The manager of the connections
+        unsigned int minSize; //!< Number of connections per destination which are kept open even if idle
+        unsigned int maxSize; //!< Maximum number of connections per destination (leased and idle)
+        double idleTimeout; //!< Seconds an idle connection above minSize is kept
+        double connectTimeout; //!< Connect timeout of new connections (see Socket::setConnectTimeout)
+        bool msgPack; //!< Uses newMsgPackSocket() instead of newSocket() for new connections
+
+        /*! Starts maintaining the pool every NETLINK_POOL_MAINTAIN_INTERVAL seconds
+         @param manager The manager of the connections
+         @param minSize Number of connections per destination which are kept open
+         @param maxSize Maximum number of connections per destination
+         @param msgPack Uses MsgPackSockets if true
+         */
+        ConnectionPool(SocketManager* manager, unsigned int minSize = 0, unsigned int maxSize = 8, bool msgPack = false);
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+        //! Closes all idle connections, leased ones stay open
+        ~ConnectionPool();
+
+        /*! Opens connections to a destination until minSize of them exist, so that the first leases do not wait
+         @param host The remote host (see Socket::initAsTcpClient)
+         @param port The remote port
+         */
+        void prepare(const std::string& host, unsigned int port);
+        /*! Leases a connection to a destination.
+         Prefers connected idle connections, then ones which are still connecting and opens a new one otherwise.
+         Data can be sent right away, it is delivered as soon as the connection is established.
+         @param host The remote host (see Socket::initAsTcpClient)
+         @param port The remote port
+         @return The connection or NULL if maxSize connections are leased already
+         @throws Exception if a new connection could not be opened
+         */
+        std::shared_ptr<Socket> lease(const std::string& host, unsigned int port);
+        /*! Returns a leased connection to the pool
+         @param socket The connection from lease()
+         @param reuse If false or the connection is not in a clean state it is closed instead
+         */
+        void giveBack(std::shared_ptr<Socket> socket, bool reuse = true);
+        //! Returns the number of idle connections to a destination
+        size_t getIdleCount(const std::string& host, unsigned int port) const;
+        //! Returns the number of leased connections to a destination
+        size_t getLeasedCount(const std::string& host, unsigned int port) const;
+    };
+
 };
@@ -0,0 +1,92 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BufferPool.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace netLink {
+
+BufferPool::BufferPool(size_t _bufferSize, bool _hugePages)
+    :bufferSize(_bufferSize), borrowed(0), hugePages(_hugePages) {
+    // grow() could not split a block into buffers
+    if(bufferSize == 0)
+        throw Exception(Exception::ERROR_INIT);
+}
+
+BufferPool::~BufferPool() {
+    for(const auto& block : blocks) {
+        #ifdef __linux__
+        if(block.mapped) {
+            munmap(block.memory, block.size);
+            continue;
+        }
+        #endif
+        delete[] block.memory;
+    }
+}
+
+void BufferPool::grow() {
+    // A block holds at least one buffer
+    Block block;
+    block.size = std::max(bufferSize, static_cast<size_t>(NETLINK_BUFFER_POOL_BLOCK_SIZE));
+    block.size -= block.size%bufferSize;
+    block.memory = NULL;
+    block.mapped = false;
+    #if defined(__linux__) && defined(MAP_HUGETLB)
+    if(hugePages) {
+        size_t mappedSize = (block.size+NETLINK_BUFFER_POOL_BLOCK_SIZE-1)/NETLINK_BUFFER_POOL_BLOCK_SIZE*NETLINK_BUFFER_POOL_BLOCK_SIZE;
+        void* memory = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(memory != MAP_FAILED) {
+            block.memory = static_cast<char*>(memory);
+            block.size = mappedSize;
+            block.mapped = true;
+        } else // No huge pages reserved, do not try again
+            hugePages = false;
+    }
+    #endif
+    if(!block.memory)
+        block.memory = new char[block.size];
+    blocks.push_back(block);
+    for(size_t offset = block.size-block.size%bufferSize; offset > 0; offset -= bufferSize)
+        freeBuffers.push_back(block.memory+offset-bufferSize);
+}
+
+char* BufferPool::acquire() {
+    if(freeBuffers.empty())
+        grow();
+    char* buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+    ++borrowed;
+    return buffer;
+}
+
+void BufferPool::release(char* buffer) {
+    freeBuffers.push_back(buffer);
+    --borrowed;
+}
+
+size_t BufferPool::getAllocated() const {
+    size_t size = 0;
+    for(const auto& block : blocks)
+        size += block.size;
+    return size;
+}
+
+};
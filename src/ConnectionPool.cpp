@@ -0,0 +1,184 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "netLink.h"
+
+namespace netLink {
+
+ConnectionPool::ConnectionPool(SocketManager* _manager, unsigned int _minSize, unsigned int _maxSize, bool _msgPack)
+    :maintainTimer(0), manager(_manager), minSize(_minSize), maxSize(std::max(_maxSize, 1U)),
+    idleTimeout(30.0), connectTimeout(0.0), msgPack(_msgPack) {
+    // Starts the periodic maintenance
+    maintain();
+}
+
+ConnectionPool::~ConnectionPool() {
+    manager->cancelTimer(maintainTimer);
+    for(auto& destination : destinations)
+        for(const auto& entry : destination.second.idle)
+            entry.first->disconnect();
+}
+
+bool ConnectionPool::isHealthy(const std::shared_ptr<Socket>& socket) {
+    switch(socket->getStatus()) {
+        case Socket::Status::CONNECTING:
+            return true;
+        case Socket::Status::READY:
+        case Socket::Status::BUSY:
+            break;
+        default:
+            return false;
+    }
+    // Unread data means that the previous user left the protocol in an unknown state.
+    // The manager keeps polling idle connections, so it already received such data
+    // and a close by the remote, no need to ask the system again.
+    return socket->egptr() == socket->gptr();
+}
+
+std::shared_ptr<Socket> ConnectionPool::connect(Destination& destination) {
+    std::shared_ptr<Socket> socket = (msgPack) ? manager->newMsgPackSocket() : manager->newSocket();
+    socket->setConnectTimeout(connectTimeout);
+    try {
+        socket->initAsTcpClient(destination.host, destination.port);
+    } catch(Exception err) {
+        manager->sockets.erase(socket);
+        throw err;
+    }
+    return socket;
+}
+
+ConnectionPool::Destination& ConnectionPool::getDestination(const std::string& host, unsigned int port) {
+    Destination& destination = destinations[host+'\0'+std::to_string(port)];
+    if(destination.host.empty()) {
+        destination.host = host;
+        destination.port = port;
+        destination.leased = 0;
+    }
+    return destination;
+}
+
+void ConnectionPool::maintain() {
+    maintainTimer = manager->setTimer(NETLINK_POOL_MAINTAIN_INTERVAL, [this](SocketManager*) {
+        maintain();
+    });
+    // Forget leases which were closed and dropped without giving them back
+    for(auto iter = leases.begin(); iter != leases.end(); ) {
+        std::shared_ptr<Socket> socket = iter->second.first.lock();
+        if(socket && socket->getStatus() != Socket::Status::NOT_CONNECTED) {
+            ++iter;
+            continue;
+        }
+        --destinations[iter->second.second].leased;
+        iter = leases.erase(iter);
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto expiry = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(idleTimeout));
+    for(auto iter = destinations.begin(); iter != destinations.end(); ) {
+        Destination& destination = iter->second;
+        auto& idle = destination.idle;
+        for(size_t i = 0; i < idle.size(); )
+            if(isHealthy(idle[i].first))
+                ++i;
+            else {
+                idle[i].first->disconnect();
+                idle.erase(idle.begin()+i);
+            }
+        // The least recently returned connections are the first to expire
+        while(!idle.empty() && idle.size()+destination.leased > minSize && idle.front().second+expiry <= now) {
+            idle.front().first->disconnect();
+            idle.pop_front();
+        }
+        try {
+            while(idle.size()+destination.leased < minSize)
+                idle.push_back(std::make_pair(connect(destination), now));
+        } catch(Exception err) {
+            // Tried again in the next maintenance
+        }
+        if(idle.empty() && destination.leased == 0 && minSize == 0)
+            iter = destinations.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+void ConnectionPool::prepare(const std::string& host, unsigned int port) {
+    Destination& destination = getDestination(host, port);
+    auto now = std::chrono::steady_clock::now();
+    while(destination.idle.size()+destination.leased < minSize)
+        destination.idle.push_back(std::make_pair(connect(destination), now));
+}
+
+std::shared_ptr<Socket> ConnectionPool::lease(const std::string& host, unsigned int port) {
+    Destination& destination = getDestination(host, port);
+    auto& idle = destination.idle;
+    for(size_t i = 0; i < idle.size(); )
+        if(isHealthy(idle[i].first))
+            ++i;
+        else {
+            idle[i].first->disconnect();
+            idle.erase(idle.begin()+i);
+        }
+    std::shared_ptr<Socket> socket;
+    if(!idle.empty()) {
+        // The most recently returned connection is the least likely to be closed by the remote
+        auto chosen = idle.end()-1;
+        for(auto iter = idle.rbegin(); iter != idle.rend(); ++iter)
+            if(iter->first->getStatus() != Socket::Status::CONNECTING) {
+                chosen = iter.base()-1;
+                break;
+            }
+        socket = chosen->first;
+        idle.erase(chosen);
+    } else if(destination.leased < maxSize)
+        socket = connect(destination);
+    else
+        return NULL;
+    auto& entry = leases[socket.get()];
+    // The address might belong to a lease which was dropped without giving it back
+    if(!entry.second.empty())
+        --destinations[entry.second].leased;
+    entry = std::make_pair(std::weak_ptr<Socket>(socket), host+'\0'+std::to_string(port));
+    ++destination.leased;
+    return socket;
+}
+
+void ConnectionPool::giveBack(std::shared_ptr<Socket> socket, bool reuse) {
+    auto lease = leases.find(socket.get());
+    if(lease == leases.end() || lease->second.first.lock() != socket)
+        return;
+    Destination& destination = destinations[lease->second.second];
+    leases.erase(lease);
+    --destination.leased;
+    if(reuse && isHealthy(socket) && destination.idle.size()+destination.leased < maxSize)
+        destination.idle.push_back(std::make_pair(socket, std::chrono::steady_clock::now()));
+    else
+        socket->disconnect();
+}
+
+size_t ConnectionPool::getIdleCount(const std::string& host, unsigned int port) const {
+    auto iter = destinations.find(host+'\0'+std::to_string(port));
+    return (iter == destinations.end()) ? 0 : iter->second.idle.size();
+}
+
+size_t ConnectionPool::getLeasedCount(const std::string& host, unsigned int port) const {
+    auto iter = destinations.find(host+'\0'+std::to_string(port));
+    return (iter == destinations.end()) ? 0 : iter->second.leased;
+}
+
+};
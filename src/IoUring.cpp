@@ -0,0 +1,126 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "IoUring.h"
+
+#ifdef NETLINK_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace netLink {
+
+IoUring::IoUring(unsigned int entries) :sqPending(0) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    handle = syscall(__NR_io_uring_setup, entries, &params);
+    if(handle == -1)
+        throw Exception(Exception::ERROR_INIT);
+    if(!(params.features & IORING_FEAT_EXT_ARG)) {
+        close(handle);
+        throw Exception(Exception::ERROR_INIT);
+    }
+
+    sqRingSize = params.sq_off.array+params.sq_entries*sizeof(unsigned int);
+    cqRingSize = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+    sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    sqRing = mmap(NULL, sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, handle, IORING_OFF_SQ_RING);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+        cqRing = sqRing;
+    else
+        cqRing = mmap(NULL, cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, handle, IORING_OFF_CQ_RING);
+    sqes = reinterpret_cast<struct io_uring_sqe*>(mmap(NULL, sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, handle, IORING_OFF_SQES));
+    if(sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        close(handle);
+        throw Exception(Exception::ERROR_INIT);
+    }
+
+    char* sq = reinterpret_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned int*>(sq+params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned int*>(sq+params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned int*>(sq+params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned int*>(sq+params.sq_off.array);
+    char* cq = reinterpret_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned int*>(cq+params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned int*>(cq+params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned int*>(cq+params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq+params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    munmap(sqes, sqesSize);
+    if(cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    munmap(sqRing, sqRingSize);
+    close(handle);
+}
+
+struct io_uring_sqe* IoUring::getSqe() {
+    unsigned int tail = *sqTail;
+    if(tail-__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > *sqMask) {
+        enter();
+        tail = *sqTail;
+    }
+    unsigned int index = tail & *sqMask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail+1, __ATOMIC_RELEASE);
+    ++sqPending;
+    return sqe;
+}
+
+void IoUring::enter(double waitUpToSeconds) {
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    unsigned int flags = IORING_ENTER_EXT_ARG, minComplete = 0;
+    if(waitUpToSeconds != 0.0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        minComplete = 1;
+        if(waitUpToSeconds > 0.0) {
+            timeout.tv_sec = waitUpToSeconds;
+            timeout.tv_nsec = fmod(waitUpToSeconds, 1.0) * 1000000000.0;
+            arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        }
+    }
+    if(sqPending == 0 && minComplete == 0)
+        return;
+    int result = syscall(__NR_io_uring_enter, handle, sqPending, minComplete, flags, &arg, sizeof(arg));
+    if(result >= 0)
+        sqPending -= std::min(sqPending, static_cast<unsigned int>(result));
+    else if(errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+        throw Exception(Exception::ERROR_SELECT);
+}
+
+void IoUring::complete(const CompletionCallback& callback) {
+    unsigned int head = *cqHead;
+    while(head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe& cqe = cqes[head & *cqMask];
+        uint64_t userData = cqe.user_data;
+        int32_t result = cqe.res;
+        uint32_t flags = cqe.flags;
+        __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+        callback(userData, result, flags);
+    }
+}
+
+};
+#endif
@@ -767,6 +767,10 @@ namespace MsgPack {
         return static_cast<uint32_t>(getHeaderLength());
     }
 
+    uint32_t ArrayHeader::getStreamedChildren() const {
+        return getLength();
+    }
+
     int64_t ArrayHeader::getHeaderLength() const {
         uint8_t type = static_cast<const uint8_t>(header[0]);
         if(type >= Type::FIXARRAY && type < Type::FIXSTR)
@@ -823,6 +827,10 @@ namespace MsgPack {
         return static_cast<uint32_t>(getHeaderLength());
     }
 
+    uint32_t MapHeader::getStreamedChildren() const {
+        return getLength()*2;
+    }
+
     uint32_t MapHeader::getLength() const {
         uint8_t type = static_cast<const uint8_t>(header[0]);
         if(type >= Type::FIXMAP && type < Type::FIXARRAY)
@@ -884,6 +892,11 @@ namespace MsgPack {
         return size;
     }
 
+    uint32_t Array::getStreamedChildren() const {
+        // The children are part of the element itself
+        return 0;
+    }
+
     std::vector<std::unique_ptr<Element>>* Array::getElementsVector() {
         return &elements;
     }
@@ -951,6 +964,10 @@ namespace MsgPack {
         return size;
     }
 
+    uint32_t Map::getStreamedChildren() const {
+        return 0;
+    }
+
     std::vector<std::unique_ptr<Element>>* Map::getElementsVector() {
         return &elements;
     }
@@ -1009,7 +1026,20 @@ namespace MsgPack {
             StackElement* stackPointer = &stack[stack.size()-1];
 
             // Serialize element
-            std::streamsize bytesWritten = stackPointer->first->serialize(stackPointer->second, streamBuffer, bytesLeft);
+            std::streamsize bytesWritten;
+            const char* body = (referenceBody) ? stackPointer->first->getBody() : NULL;
+            if(body && stackPointer->first->getEndPos() >= referenceThreshold) {
+                // Only getBody() of Data returns a body
+                Data* data = static_cast<Data*>(stackPointer->first);
+                if(stackPointer->second < 0) // Copy the header only
+                    bytesWritten = data->Header::serialize(stackPointer->second, streamBuffer, bytesLeft);
+                else { // Reference the body
+                    bytesWritten = referenceBody(body+stackPointer->second, std::min(bytesLeft, (std::streamsize)(data->getEndPos()-stackPointer->second)));
+                    stackPointer->second += bytesWritten;
+                    rootReferenced = true;
+                }
+            } else
+                bytesWritten = stackPointer->first->serialize(stackPointer->second, streamBuffer, bytesLeft);
             bytesLeft -= bytesWritten;
             bytesDone += bytesWritten;
 
@@ -1052,8 +1082,12 @@ namespace MsgPack {
             stack.erase(stack.begin()+stackIndex, stack.end());
 
             // Check if root element is done
-            if(stackIndex == 0)
+            if(stackIndex == 0) {
+                if(rootReferenced) // Keep the referenced bodies alive
+                    referencedElements.push_back(std::move(rootElement));
                 rootElement.reset();
+                rootReferenced = false;
+            }
         }
 
         return bytesDone;
@@ -0,0 +1,127 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "netLink.h"
+
+namespace netLink {
+
+void MsgPackSocket::onReadable() {
+    if(!manager->onReceiveMsgPack) {
+        super::onReadable();
+        return;
+    }
+    std::shared_ptr<Socket> socket = shared_from_this();
+    std::unique_ptr<MsgPack::Element> element;
+    while(true) {
+        deserializer >> element;
+        if(!element)
+            break;
+        manager->onReceiveMsgPack(manager, socket, std::move(element));
+    }
+}
+
+void MsgPackSocket::onWritable() {
+    // Continues the element in progress first, so lanes only interleave at top-level element boundaries
+    std::streamsize written = serializer.serialize([this]() {
+        std::unique_ptr<MsgPack::Element> element;
+        for(int lane = NETLINK_MSGPACK_PRIORITY_LANES-1; lane >= 0; --lane) {
+            // The children of a streamed container must not be interleaved with other lanes
+            if(openChildren > 0 && lane != openLane)
+                continue;
+            while(queues[lane].size()) {
+                element = std::move(queues[lane].front());
+                queues[lane].pop();
+                if(element) {
+                    size_t size = element->getSizeInBytes();
+                    queuedBytes -= std::min(size, queuedBytes);
+                    serializingBytes += size;
+                    if(openChildren > 0)
+                        --openChildren;
+                    openChildren += element->getStreamedChildren();
+                    openLane = lane;
+                    return element;
+                }
+            }
+        }
+        return element;
+    });
+    serializingBytes -= std::min(static_cast<size_t>(written), serializingBytes);
+    super::onWritable();
+    if(backpressure && getQueuedBytes() <= lowWatermark) {
+        backpressure = false;
+        if(manager && manager->onBackpressure)
+            manager->onBackpressure(manager, shared_from_this(), false);
+    }
+}
+
+void MsgPackSocket::send(std::unique_ptr<MsgPack::Element> element, unsigned int priority) {
+    if(element)
+        queuedBytes += element->getSizeInBytes();
+    queues[std::min(priority, NETLINK_MSGPACK_PRIORITY_LANES-1U)].push(std::move(element));
+    flushLater();
+    if(!backpressure && highWatermark > 0 && getQueuedBytes() >= highWatermark) {
+        backpressure = true;
+        if(manager && manager->onBackpressure)
+            manager->onBackpressure(manager, shared_from_this(), true);
+    }
+}
+
+bool MsgPackSocket::trySend(std::unique_ptr<MsgPack::Element>& element, unsigned int priority) {
+    if(backpressure)
+        return false;
+    send(std::move(element), priority);
+    return true;
+}
+
+void MsgPackSocket::setQueueLimit(size_t _highWatermark, size_t _lowWatermark) {
+    highWatermark = _highWatermark;
+    lowWatermark = std::min(_lowWatermark, _highWatermark);
+    backpressure = highWatermark > 0 && getQueuedBytes() >= highWatermark;
+}
+
+size_t MsgPackSocket::getQueuedBytes() {
+    size_t bytes = queuedBytes+serializingBytes+getOutputBufferPending();
+    for(const auto& reference : outputReferences)
+        bytes += reference.size;
+    return bytes;
+}
+
+void MsgPackSocket::releaseOutput() {
+    serializer.releaseReferences();
+}
+
+void MsgPackSocket::setGatherThreshold(std::streamsize bytes) {
+    if(type != TCP_CLIENT && type != TCP_SERVERS_CLIENT)
+        throw Exception(Exception::BAD_TYPE);
+    serializer.referenceThreshold = bytes;
+    if(bytes > 0)
+        serializer.referenceBody = [this](const char_type* body, std::streamsize size) {
+            return referenceOutput(body, size);
+        };
+    else
+        serializer.referenceBody = nullptr;
+}
+
+bool MsgPackSocket::hasPendingOutput() {
+    for(const auto& queue : queues)
+        if(queue.size())
+            return true;
+    return super::hasPendingOutput();
+}
+
+};
@@ -0,0 +1,191 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "netLink.h"
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+namespace netLink {
+
+Resolver::Resolver() :idleThreads(0), stopping(false), wakeupHandle(-1),
+    cacheTime(NETLINK_RESOLVER_CACHE_TIME), maxThreads(NETLINK_RESOLVER_THREADS) {
+    #ifdef __linux__
+    wakeupHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeupHandle == -1)
+        throw Exception(Exception::ERROR_INIT);
+    #endif
+}
+
+Resolver::~Resolver() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queries.clear();
+    }
+    condition.notify_all();
+    for(auto& thread : threads)
+        thread.join();
+    #ifdef __linux__
+    close(wakeupHandle);
+    #endif
+}
+
+std::string Resolver::getKey(const std::string& host, unsigned int port, int family, int socktype) {
+    return host+'\0'+std::to_string(port)+'\0'+std::to_string(family)+'\0'+std::to_string(socktype);
+}
+
+std::vector<Endpoint> Resolver::query(const char* host, unsigned int port, int family, int socktype, bool passive) {
+    struct addrinfo conf, *res;
+    memset(&conf, 0, sizeof(conf));
+    conf.ai_flags = AI_V4MAPPED;
+    if(passive)
+        conf.ai_flags |= AI_PASSIVE;
+    conf.ai_family = family;
+    conf.ai_socktype = socktype;
+    char portStr[10];
+    snprintf(portStr, 10, "%u", port);
+    std::vector<Endpoint> addresses;
+    if(getaddrinfo(host, portStr, &conf, &res) != 0)
+        return addresses;
+    for(struct addrinfo* nextAddr = res; nextAddr; nextAddr = nextAddr->ai_next) {
+        if(nextAddr->ai_addrlen > sizeof(struct sockaddr_storage))
+            continue;
+        Endpoint endpoint;
+        memcpy(&endpoint.address, nextAddr->ai_addr, nextAddr->ai_addrlen);
+        endpoint.addressLength = nextAddr->ai_addrlen;
+        addresses.push_back(endpoint);
+    }
+    freeaddrinfo(res);
+    return addresses;
+}
+
+bool Resolver::isNumeric(const std::string& host) {
+    struct in6_addr address;
+    return inet_pton(AF_INET, host.c_str(), &address) == 1 || inet_pton(AF_INET6, host.c_str(), &address) == 1;
+}
+
+bool Resolver::lookup(const std::string& host, unsigned int port, int family, int socktype, std::vector<Endpoint>& addresses) {
+    auto iter = cache.find(getKey(host, port, family, socktype));
+    if(iter == cache.end())
+        return false;
+    if(iter->second.expiry <= std::chrono::steady_clock::now()) {
+        cache.erase(iter);
+        return false;
+    }
+    addresses = iter->second.addresses;
+    return true;
+}
+
+void Resolver::store(const std::string& key, const std::vector<Endpoint>& addresses) {
+    if(cacheTime <= 0.0 || addresses.empty())
+        return;
+    auto now = std::chrono::steady_clock::now();
+    if(cache.size() >= NETLINK_RESOLVER_CACHE_SIZE && !cache.count(key)) {
+        // Make room by dropping the expired entries, otherwise any entry
+        for(auto iter = cache.begin(); iter != cache.end(); )
+            if(iter->second.expiry <= now)
+                iter = cache.erase(iter);
+            else
+                ++iter;
+        if(cache.size() >= NETLINK_RESOLVER_CACHE_SIZE)
+            cache.erase(cache.begin());
+    }
+    CacheEntry& entry = cache[key];
+    entry.addresses = addresses;
+    entry.expiry = now+std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(cacheTime));
+}
+
+std::vector<Endpoint> Resolver::resolve(const std::string& host, unsigned int port, int family, int socktype) {
+    std::vector<Endpoint> addresses;
+    if(lookup(host, port, family, socktype, addresses))
+        return addresses;
+    addresses = query(host.c_str(), port, family, socktype);
+    if(addresses.empty())
+        throw Exception(Exception::ERROR_RESOLVING_ADDRESS);
+    store(getKey(host, port, family, socktype), addresses);
+    return addresses;
+}
+
+void Resolver::resolve(const std::string& host, unsigned int port, int family, int socktype, Callback callback) {
+    std::string key = getKey(host, port, family, socktype);
+    std::vector<Callback>& callbacks = waiting[key];
+    callbacks.push_back(callback);
+    if(callbacks.size() > 1) // The same query is in progress already
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    Query query = { key, host, port, family, socktype };
+    queries.push_back(query);
+    if(queries.size() > idleThreads && threads.size() < maxThreads)
+        threads.push_back(std::thread(&Resolver::work, this));
+    condition.notify_one();
+}
+
+void Resolver::complete() {
+    if(waiting.empty())
+        return;
+    #ifdef __linux__
+    uint64_t count;
+    if(read(wakeupHandle, &count, sizeof(count)) != sizeof(count))
+        return;
+    #endif
+    std::vector<std::pair<std::string, std::vector<Endpoint>>> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.swap(results);
+    }
+    for(const auto& result : done) {
+        store(result.first, result.second);
+        auto iter = waiting.find(result.first);
+        if(iter == waiting.end())
+            continue;
+        // Callbacks might resolve the same host again
+        std::vector<Callback> callbacks;
+        callbacks.swap(iter->second);
+        waiting.erase(iter);
+        for(const auto& callback : callbacks)
+            callback(result.second);
+    }
+}
+
+void Resolver::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        ++idleThreads;
+        condition.wait(lock, [this]() {
+            return stopping || !queries.empty();
+        });
+        --idleThreads;
+        if(stopping)
+            return;
+        Query next = queries.front();
+        queries.pop_front();
+        lock.unlock();
+        std::vector<Endpoint> addresses = query(next.host.c_str(), next.port, next.family, next.socktype);
+        lock.lock();
+        results.push_back(std::make_pair(next.key, std::move(addresses)));
+        #ifdef __linux__
+        uint64_t count = 1;
+        // Only fails if the counter would overflow, then it is readable anyway
+        ssize_t written = write(wakeupHandle, &count, sizeof(count));
+        (void)written;
+        #endif
+    }
+}
+
+};
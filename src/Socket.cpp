@@ -16,7 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include "Socket.h"
+#include "netLink.h"
 
 namespace netLink {
 
@@ -31,6 +31,86 @@ void init() {
 #define closesocket close
 #endif
 
+static bool wouldBlock() {
+    #ifdef WINVER
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+    #else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+    #endif
+}
+
+//! Returns the error of the last failed system call
+static int lastError() {
+    #ifdef WINVER
+    return WSAGetLastError();
+    #else
+    return errno;
+    #endif
+}
+
+//! Returns true if error only reports that the remote refused an earlier datagram (ICMP port unreachable), which a UDP_PEER survives
+static bool refusedDatagram(int error) {
+    #ifdef WINVER
+    return error == WSAECONNRESET;
+    #else
+    return error == ECONNREFUSED;
+    #endif
+}
+
+//! Returns true if a nonblocking connect did not fail but is still in progress
+static bool connectInProgress() {
+    #ifdef WINVER
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+    #else
+    return errno == EINPROGRESS;
+    #endif
+}
+
+/*! Allocates an intermediate buffer, large ones are mapped twice in a row (Linux),
+    so that a ring buffer can be used as contiguous get or put area without moving data
+ @param size Requested size, rounded up to whole pages if mirrored
+ @param ring Buffer is allowed to be mirrored
+ @param mirrored Set to true if the buffer is mirrored
+ */
+static char* allocateBuffer(std::streamsize& size, bool ring, bool& mirrored) {
+    mirrored = false;
+    #ifdef __linux__
+    if(ring && size >= NETLINK_MIN_RING_BUFFER_SIZE) {
+        std::streamsize page = sysconf(_SC_PAGESIZE), length = (size+page-1)/page*page;
+        int memory = memfd_create("netLink", MFD_CLOEXEC);
+        if(memory != -1) {
+            void* area = MAP_FAILED;
+            if(ftruncate(memory, length) == 0)
+                area = mmap(NULL, 2*length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(area != MAP_FAILED) {
+                char* buffer = static_cast<char*>(area);
+                if(mmap(buffer, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memory, 0) != MAP_FAILED &&
+                   mmap(buffer+length, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memory, 0) != MAP_FAILED) {
+                    close(memory);
+                    size = length;
+                    mirrored = true;
+                    return buffer;
+                }
+                munmap(area, 2*length);
+            }
+            close(memory);
+        }
+    }
+    #endif
+    return new char[size];
+}
+
+//! Frees a buffer of allocateBuffer()
+static void freeBuffer(char* buffer, std::streamsize size, bool mirrored) {
+    #ifdef __linux__
+    if(mirrored) {
+        munmap(buffer, 2*size);
+        return;
+    }
+    #endif
+    delete[] buffer;
+}
+
 static void readSockaddr(const struct sockaddr_storage* addr, std::string& host, unsigned int& port) {
     char buffer[INET6_ADDRSTRLEN];
     if(addr->ss_family == AF_INET) {
@@ -45,41 +125,111 @@ static void readSockaddr(const struct sockaddr_storage* addr, std::string& host,
     host = buffer;
 }
 
-Socket::AddrinfoContainer Socket::getSocketInfoFor(const char* host, unsigned int port, bool wildcardAddress) {
-    struct addrinfo conf, *res;
-    memset(&conf, 0, sizeof(conf));
-    conf.ai_flags = AI_V4MAPPED;
+std::string Endpoint::getHost() const {
+    std::string host;
+    unsigned int port;
+    if(!isValid())
+        return host;
+    readSockaddr(&address, host, port);
+    return host;
+}
+
+unsigned int Endpoint::getPort() const {
+    if(!isValid())
+        return 0;
+    if(address.ss_family == AF_INET)
+        return ntohs(reinterpret_cast<const struct sockaddr_in*>(&address)->sin_port);
+    else
+        return ntohs(reinterpret_cast<const struct sockaddr_in6*>(&address)->sin6_port);
+}
+
+bool Endpoint::operator==(const Endpoint& other) const {
+    if(addressLength != other.addressLength || address.ss_family != other.address.ss_family)
+        return false;
+    if(!isValid())
+        return true;
+    if(address.ss_family == AF_INET) {
+        auto a = reinterpret_cast<const struct sockaddr_in*>(&address),
+             b = reinterpret_cast<const struct sockaddr_in*>(&other.address);
+        return a->sin_port == b->sin_port && memcmp(&a->sin_addr, &b->sin_addr, sizeof(a->sin_addr)) == 0;
+    } else {
+        auto a = reinterpret_cast<const struct sockaddr_in6*>(&address),
+             b = reinterpret_cast<const struct sockaddr_in6*>(&other.address);
+        return a->sin6_port == b->sin6_port && a->sin6_scope_id == b->sin6_scope_id &&
+               memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+    }
+}
+
+size_t Endpoint::hash() const {
+    // FNV-1a over the bytes which operator== compares
+    const unsigned char* bytes;
+    size_t length, hash = static_cast<size_t>(14695981039346656037ULL);
+    uint16_t port;
+    if(address.ss_family == AF_INET) {
+        auto sin = reinterpret_cast<const struct sockaddr_in*>(&address);
+        bytes = reinterpret_cast<const unsigned char*>(&sin->sin_addr);
+        length = sizeof(sin->sin_addr);
+        port = sin->sin_port;
+    } else {
+        auto sin = reinterpret_cast<const struct sockaddr_in6*>(&address);
+        bytes = reinterpret_cast<const unsigned char*>(&sin->sin6_addr);
+        length = sizeof(sin->sin6_addr);
+        port = sin->sin6_port;
+    }
+    for(size_t i = 0; i < length; ++i)
+        hash = (hash ^ bytes[i]) * static_cast<size_t>(1099511628211ULL);
+    return (hash ^ port) * static_cast<size_t>(1099511628211ULL);
+}
+
+//! Returns the address family of getaddrinfo for an IPVersion
+static int addressFamily(Socket::IPVersion ipVersion) {
     switch(ipVersion) {
-        case IPv4:
-            conf.ai_family = AF_INET;
-            break;
-        case IPv6:
-            conf.ai_family = AF_INET6;
-            break;
+        case Socket::IPv4:
+            return AF_INET;
+        case Socket::IPv6:
+            return AF_INET6;
         default:
-            conf.ai_family = AF_UNSPEC;
-            break;
+            return AF_UNSPEC;
     }
-    if(wildcardAddress)
-        conf.ai_flags |= AI_PASSIVE;
+}
+
+//! Orders addresses for racing connects (RFC 8305), alternating between the family of the first one and the other
+static std::vector<Endpoint> interleaveFamilies(const std::vector<Endpoint>& addresses) {
+    std::vector<Endpoint> preferred, other, ordered;
+    for(const auto& address : addresses)
+        if(address.getAddress()->sa_family == addresses.front().getAddress()->sa_family)
+            preferred.push_back(address);
+        else
+            other.push_back(address);
+    for(size_t i = 0; i < preferred.size() || i < other.size(); ++i) {
+        if(i < preferred.size())
+            ordered.push_back(preferred[i]);
+        if(i < other.size())
+            ordered.push_back(other[i]);
+    }
+    return ordered;
+}
+
+std::vector<Endpoint> Socket::getSocketInfoFor(const char* host, unsigned int port, bool wildcardAddress) {
+    int socktype;
     switch(type) {
         case TCP_CLIENT:
         case TCP_SERVER:
-            conf.ai_socktype = SOCK_STREAM;
+            socktype = SOCK_STREAM;
             break;
         case UDP_PEER:
-            conf.ai_socktype = SOCK_DGRAM;
+            socktype = SOCK_DGRAM;
             break;
         default:
             disconnect();
             throw Exception(Exception::BAD_PROTOCOL);
     }
-    char portStr[10];
-    snprintf(portStr, 10, "%u", port);
-    int result = getaddrinfo(host, portStr, &conf, &res);
-    if(result != 0)
+    if(!wildcardAddress && manager)
+        return manager->resolver.resolve(host, port, addressFamily(ipVersion), socktype);
+    std::vector<Endpoint> addresses = Resolver::query(host, port, addressFamily(ipVersion), socktype, wildcardAddress);
+    if(addresses.empty())
         throw Exception(Exception::ERROR_RESOLVING_ADDRESS);
-    return AddrinfoContainer(res);
+    return addresses;
 }
 
 Socket::pos_type Socket::seekoff(Socket::off_type off, std::ios_base::seekdir way, std::ios_base::openmode which) {
@@ -139,18 +289,41 @@ Socket::pos_type Socket::seekpos(Socket::pos_type sp, std::ios_base::openmode wh
 int Socket::sync() {
     if(getOutputBufferSize() == 0) // No output buffer
         return EOF;
+    if(splicePending > 0) { // Redirected data goes first
+        try {
+            if(sendSplicePipe() > 0)
+                return 0;
+        } catch(Exception err) {
+            return EOF;
+        }
+    }
+    if(!outputReferences.empty()) {
+        try {
+            sendGathered();
+        } catch(Exception err) {
+            return EOF;
+        }
+        return 0;
+    }
     if(pptr() == pbase()) // Allready in sync
         return 0;
+    std::streamsize pending = pptr()-pbase(), sent;
     try {
-        std::streamsize rest = pptr()-pbase(),
-                        sentBytes = send(pbase(), rest);
-        rest -= sentBytes;
-        memmove(pbase(), pbase()+sentBytes, rest);
-        setp(pbase(), epptr());
-        pbump(rest);
+        sent = send(pbase(), pending);
     } catch(Exception err) {
         return EOF;
     }
+    consumeOutput(sent);
+    if(adaptiveMaxSize > 0) {
+        // Sending a full buffer at once again and again means that it is too small
+        outputFullCount = (pending == getOutputBufferSize() && sent == pending) ? outputFullCount+1 : 0;
+        if(outputFullCount >= NETLINK_BUFFER_GROW_COUNT && getOutputBufferSize() < adaptiveMaxSize) {
+            outputFullCount = 0;
+            setOutputBufferSize(std::min(2*getOutputBufferSize(), adaptiveMaxSize));
+            if(manager)
+                manager->scheduleShrink(this);
+        }
+    }
     return 0;
 }
 
@@ -165,14 +338,24 @@ std::streamsize Socket::xsgetn(char_type* buffer, std::streamsize size) {
 }
 
 Socket::int_type Socket::underflow() {
-    if(type == UDP_PEER || advanceInputBuffer() <= 0)
+    if(type == UDP_PEER)
         return EOF;
+    try {
+        if(advanceInputBuffer() <= 0)
+            return EOF;
+    } catch(Exception err) {
+        return EOF;
+    }
     return *eback();
 }
 
 std::streamsize Socket::xsputn(const char_type* buffer, std::streamsize size) {
-    if(getOutputBufferSize()) // Write into buffer
+    if(getOutputBufferSize()) { // Write into buffer
+        flushLater();
+        borrowOutputBuffer();
+        fitPutArea();
         return super::xsputn(buffer, size);
+    }
     try {
         return send(buffer, size);
     } catch(Exception err) {
@@ -180,36 +363,121 @@ std::streamsize Socket::xsputn(const char_type* buffer, std::streamsize size) {
     }
 }
 
+void Socket::consumeOutput(std::streamsize bytes) {
+    if(bytes == 0)
+        return;
+    std::streamsize rest = pptr()-pbase()-bytes;
+    if(outputMirrored) { // Move the put area along the ring buffer
+        char_type* begin = pbase()+bytes;
+        if(begin >= outputIntermediateBuffer+outputIntermediateSize)
+            begin -= outputIntermediateSize;
+        setp(begin, begin+outputIntermediateSize);
+    } else {
+        memmove(pbase(), pbase()+bytes, rest);
+        setp(pbase(), epptr());
+    }
+    pbump(rest);
+    fitPutArea();
+}
+
+void Socket::fitPutArea() {
+    if(!pbase())
+        return;
+    std::streamsize pending = pptr()-pbase();
+    bool closed = manager && !flushScheduled && manager->getWatch(this);
+    setp(pbase(), (closed) ? pptr() : pbase()+outputIntermediateSize);
+    pbump(pending);
+}
+
 Socket::int_type Socket::overflow(int_type c) {
-    if(sync() == EOF)
-        return EOF;
-    *pbase() = c;
-    pbump(1);
+    // The put area might only have ended at the pending output to notice new output (see fitPutArea)
+    if(!pbase() || pptr() == pbase()+outputIntermediateSize) {
+        if(sync() == EOF)
+            return EOF;
+        borrowOutputBuffer();
+        if(!pbase() || pptr() == pbase()+outputIntermediateSize) // Could not make room
+            return EOF;
+    }
+    if(c != EOF) {
+        flushLater();
+        fitPutArea();
+        *pptr() = c;
+        pbump(1);
+    }
     return c;
 }
 
 
 
 void Socket::initSocket(bool blockingConnect) {
-    AddrinfoContainer info;
-    if(type == TCP_CLIENT)
-        info = getSocketInfoFor(hostRemote.c_str(), portRemote, false);
-    else {
-        const char* host;
-        if(!hostLocal.compare("") || !hostLocal.compare("*"))
-            host = NULL;
-        else
-            host = hostLocal.c_str();
-        info = getSocketInfoFor(host, portLocal, true);
-    }
-    struct addrinfo* nextAddr = info.get();
-    while(nextAddr) {
-        handle = socket(nextAddr->ai_family, nextAddr->ai_socktype, nextAddr->ai_protocol);
-        if(handle == -1) {
-            nextAddr = nextAddr->ai_next;
-            continue;
+    try {
+        std::vector<Endpoint> addresses;
+        if(type == TCP_CLIENT) {
+            if(manager && !blockingConnect && !Resolver::isNumeric(hostRemote) &&
+               !manager->resolver.lookup(hostRemote, portRemote, addressFamily(ipVersion), SOCK_STREAM, addresses)) {
+                // Resolving would block the manager, connect once it is done in listen()
+                status = CONNECTING;
+                resolving = true;
+                setInputBufferSize(NETLINK_DEFAULT_INPUT_BUFFER_SIZE);
+                setOutputBufferSize(NETLINK_DEFAULT_OUTPUT_BUFFER_SIZE);
+                std::weak_ptr<Socket> weakSocket = shared_from_this();
+                manager->resolver.resolve(hostRemote, portRemote, addressFamily(ipVersion), SOCK_STREAM, [weakSocket](const std::vector<Endpoint>& addresses) {
+                    std::shared_ptr<Socket> socket = weakSocket.lock();
+                    if(!socket || !socket->resolving)
+                        return;
+                    SocketManager* manager = socket->manager;
+                    try {
+                        if(addresses.empty()) {
+                            socket->disconnect();
+                            throw Exception(Exception::ERROR_RESOLVING_ADDRESS);
+                        }
+                        socket->openSocket(addresses, false);
+                    } catch(Exception err) {
+                        if(manager && manager->onStatusChange)
+                            manager->onStatusChange(manager, socket, CONNECTING);
+                        return;
+                    }
+                    socket->resolving = false;
+                    if(manager)
+                        manager->watch(socket, NULL);
+                });
+                return;
+            }
+            if(addresses.empty())
+                addresses = getSocketInfoFor(hostRemote.c_str(), portRemote, false);
+        } else {
+            const char* host;
+            if(!hostLocal.compare("") || !hostLocal.compare("*"))
+                host = NULL;
+            else
+                host = hostLocal.c_str();
+            addresses = getSocketInfoFor(host, portLocal, true);
         }
-        switch(nextAddr->ai_family) {
+        openSocket(addresses, blockingConnect);
+        setInputBufferSize(NETLINK_DEFAULT_INPUT_BUFFER_SIZE);
+        setOutputBufferSize(NETLINK_DEFAULT_OUTPUT_BUFFER_SIZE);
+        if(manager)
+            manager->watch(shared_from_this(), NULL);
+    } catch(Exception err) {
+        // Without a slot releaseSockets() would not remove it from the managed sockets
+        if(manager)
+            manager->releaseUnwatched(this);
+        throw err;
+    }
+}
+
+void Socket::openSocket(const std::vector<Endpoint>& candidates, bool blockingConnect) {
+    int socktype = (type == UDP_PEER) ? SOCK_DGRAM : SOCK_STREAM;
+    // The addresses which are left are raced by the manager
+    bool racing = type == TCP_CLIENT && !blockingConnect;
+    std::vector<Endpoint> addresses = (racing && !candidates.empty()) ? interleaveFamilies(candidates) : candidates;
+    connectCandidates.clear();
+    for(size_t i = 0; i < addresses.size(); ++i) {
+        const Endpoint& nextAddr = addresses[i];
+        handle = socket(nextAddr.getAddress()->sa_family, socktype, 0);
+        if(handle == -1)
+            continue;
+        switch(nextAddr.getAddress()->sa_family) {
             case AF_INET:
                 ipVersion = IPv4;
             break;
@@ -244,7 +512,9 @@ void Socket::initSocket(bool blockingConnect) {
                 disconnect();
                 throw Exception(Exception::BAD_TYPE);
             case TCP_CLIENT:
-                if(connect(handle, nextAddr->ai_addr, nextAddr->ai_addrlen) == -1 && blockingConnect) {
+                // Unless it is the last address, one which fails right away is skipped
+                if(connect(handle, nextAddr.getAddress(), nextAddr.getAddressLength()) == -1 &&
+                   (blockingConnect || (i+1 < addresses.size() && !connectInProgress()))) {
                     closesocket(handle);
                     handle = -1;
                 } else if(blockingConnect)
@@ -253,7 +523,7 @@ void Socket::initSocket(bool blockingConnect) {
                     status = CONNECTING;
             break;
             case TCP_SERVER: {
-                if(bind(handle, nextAddr->ai_addr, nextAddr->ai_addrlen) == -1) {
+                if(bind(handle, nextAddr.getAddress(), nextAddr.getAddressLength()) == -1) {
                     closesocket(handle);
                     handle = -1;
                 }
@@ -263,19 +533,19 @@ void Socket::initSocket(bool blockingConnect) {
                 }
             } break;
             case UDP_PEER: {
-                if(bind(handle, nextAddr->ai_addr, nextAddr->ai_addrlen) == -1) {
+                if(bind(handle, nextAddr.getAddress(), nextAddr.getAddressLength()) == -1) {
                     closesocket(handle);
                     handle = -1;
                 }
                 status = READY;
             } break;
         }
-        if(handle == -1) {
-            nextAddr = nextAddr->ai_next;
+        if(handle == -1)
             continue;
-        }
         if(blockingConnect)
             setBlockingMode(false);
+        if(racing)
+            connectCandidates.assign(addresses.begin()+i+1, addresses.end());
         break;
     }
     if(handle == -1) {
@@ -293,8 +563,329 @@ void Socket::initSocket(bool blockingConnect) {
         throw Exception(Exception::ERROR_GET_SOCK_NAME);
     }
     readSockaddr(&localAddr, hostLocal, portLocal);
-    setInputBufferSize(NETLINK_DEFAULT_INPUT_BUFFER_SIZE);
-    setOutputBufferSize(NETLINK_DEFAULT_OUTPUT_BUFFER_SIZE);
+}
+
+void Socket::replaceHandle(Socket* attempt) {
+    closesocket(handle);
+    handle = -1;
+    if(attempt) {
+        handle = attempt->handle;
+        ipVersion = attempt->ipVersion;
+        hostLocal = attempt->hostLocal;
+        portLocal = attempt->portLocal;
+        attempt->handle = -1;
+        attempt->status = NOT_CONNECTED;
+        return;
+    }
+    std::vector<Endpoint> addresses;
+    addresses.swap(connectCandidates);
+    openSocket(addresses, false);
+}
+
+void Socket::flushLater() {
+    if(manager && !flushScheduled && handle != -1)
+        manager->markPending(this);
+}
+
+void Socket::onReadable() {
+    if(manager->onReceiveRaw)
+        manager->onReceiveRaw(manager, shared_from_this());
+}
+
+void Socket::onWritable() {
+    if(queuedSent < queuedDestinations.size())
+        sendDatagrams();
+    pubsync();
+    // A socket redirecting into the pipe might still hold received data
+    if(splicePending == 0 && !spliceSource.expired()) {
+        std::shared_ptr<Socket> source = spliceSource.lock();
+        spliceSource.reset();
+        if(source->manager)
+            source->manager->pauseReceiving(source.get(), false);
+        if(source->egptr() > source->gptr())
+            source->onReadable();
+    }
+}
+
+bool Socket::hasPendingOutput() {
+    return getOutputBufferPending() > 0 || !outputReferences.empty() || splicePending > 0 || queuedSent < queuedDestinations.size();
+}
+
+std::streamsize Socket::referenceOutput(const char_type* data, std::streamsize size) {
+    if(outputReferences.size() >= NETLINK_MAX_OUTPUT_REFERENCES)
+        return 0;
+    OutputReference reference;
+    reference.offset = pptr()-pbase();
+    reference.data = data;
+    reference.size = size;
+    outputReferences.push_back(reference);
+    flushLater();
+    return size;
+}
+
+std::streamsize Socket::sendGathered() {
+    if(status != Socket::Status::READY)
+        return 0;
+    std::streamsize sentBytes = 0;
+    while(pptr() > pbase() || !outputReferences.empty()) {
+        // Interleave the output intermediate buffer with the referenced data
+        #ifdef WINVER
+        WSABUF vectors[NETLINK_MAX_OUTPUT_REFERENCES*2+1];
+        #else
+        struct iovec vectors[NETLINK_MAX_OUTPUT_REFERENCES*2+1];
+        #endif
+        unsigned int count = 0;
+        auto append = [&](const char_type* base, std::streamsize length) {
+            #ifdef WINVER
+            vectors[count].buf = const_cast<CHAR*>(base);
+            vectors[count++].len = length;
+            #else
+            vectors[count].iov_base = const_cast<char_type*>(base);
+            vectors[count++].iov_len = length;
+            #endif
+        };
+        std::streamsize cursor = 0;
+        size_t index = 0;
+        bool zeroCopy = false;
+        for(; index < outputReferences.size(); ++index) {
+            const auto& reference = outputReferences[index];
+            if(reference.offset > cursor) {
+                append(pbase()+cursor, reference.offset-cursor);
+                cursor = reference.offset;
+            }
+            if(zeroCopyThreshold > 0 && reference.size >= zeroCopyThreshold) {
+                // Send it alone, because the output intermediate buffer is reused right away
+                if(count == 0) {
+                    append(reference.data, reference.size);
+                    zeroCopy = true;
+                }
+                break;
+            }
+            append(reference.data, reference.size);
+        }
+        if(index == outputReferences.size() && pptr()-pbase() > cursor)
+            append(pbase()+cursor, pptr()-pbase()-cursor);
+        #ifdef WINVER
+        DWORD result;
+        if(WSASend(handle, vectors, count, &result, 0, NULL, NULL) != 0 || result == 0) {
+        #else
+        ssize_t result;
+        #if defined(__linux__) && defined(MSG_ZEROCOPY)
+        if(zeroCopy) {
+            struct msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = vectors;
+            message.msg_iovlen = count;
+            result = sendmsg(handle, &message, MSG_ZEROCOPY);
+            if(result > 0)
+                ++zeroCopySent;
+            else if(result == -1 && errno == ENOBUFS) // No memory left for the notification, copy instead
+                result = writev(handle, vectors, count);
+        } else
+        #endif
+            result = writev(handle, vectors, count);
+        if(result <= 0) {
+        #endif
+            status = BUSY;
+            if(wouldBlock())
+                break;
+            throw Exception(Exception::ERROR_SEND);
+        }
+        sentBytes += result;
+        // Drop what was sent from the buffer and the references
+        std::streamsize left = result, bufferSent = 0;
+        size_t referencesSent = 0;
+        cursor = 0;
+        for(auto& reference : outputReferences) {
+            std::streamsize preceding = reference.offset-cursor;
+            if(left < preceding) {
+                bufferSent += left;
+                left = 0;
+                break;
+            }
+            bufferSent += preceding;
+            left -= preceding;
+            cursor = reference.offset;
+            if(left < reference.size) {
+                reference.data += left;
+                reference.size -= left;
+                left = 0;
+                break;
+            }
+            left -= reference.size;
+            ++referencesSent;
+        }
+        bufferSent += left;
+        outputReferences.erase(outputReferences.begin(), outputReferences.begin()+referencesSent);
+        for(auto& reference : outputReferences)
+            reference.offset -= bufferSent;
+        consumeOutput(bufferSent);
+    }
+    if(outputReferences.empty() && zeroCopySent == zeroCopyCompleted)
+        releaseOutput();
+    return sentBytes;
+}
+
+void Socket::readZeroCopyCompletions() {
+    #if defined(__linux__) && defined(MSG_ZEROCOPY)
+    while(zeroCopyCompleted != zeroCopySent) {
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(struct sock_extended_err)+sizeof(struct sockaddr_storage))];
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if(recvmsg(handle, &message, MSG_ERRQUEUE) == -1)
+            break;
+        for(struct cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if(!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) &&
+               !(header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err error;
+            memcpy(&error, CMSG_DATA(header), sizeof(error));
+            if(error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0)
+                continue;
+            // Completions are reported as ranges of sends
+            zeroCopyCompleted += error.ee_data-error.ee_info+1;
+            if(error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zeroCopyThreshold = 0;
+        }
+    }
+    if(outputReferences.empty() && zeroCopySent == zeroCopyCompleted)
+        releaseOutput();
+    #endif
+}
+
+std::streamsize Socket::receiveDatagrams() {
+    std::streamsize packetSize = getInputBufferSize();
+    if(datagramBuffers.size() != static_cast<size_t>(packetSize)*datagramBatchSize) {
+        datagramBuffers.resize(static_cast<size_t>(packetSize)*datagramBatchSize);
+        datagramSenders.resize(datagramBatchSize);
+    }
+    std::streamsize lengths[NETLINK_MAX_DATAGRAM_BATCH_SIZE], segments[NETLINK_MAX_DATAGRAM_BATCH_SIZE], count = 0;
+    #ifdef __linux__
+    struct mmsghdr messages[NETLINK_MAX_DATAGRAM_BATCH_SIZE];
+    struct iovec vectors[NETLINK_MAX_DATAGRAM_BATCH_SIZE];
+    alignas(struct cmsghdr) char controls[NETLINK_MAX_DATAGRAM_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+    for(unsigned int i = 0; i < datagramBatchSize; ++i) {
+        vectors[i].iov_base = &datagramBuffers[i*packetSize];
+        vectors[i].iov_len = packetSize;
+        memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        if(!remoteConnected) {
+            messages[i].msg_hdr.msg_name = &datagramSenders[i].address;
+            messages[i].msg_hdr.msg_namelen = sizeof(datagramSenders[i].address);
+        }
+        if(receiveOffload) {
+            messages[i].msg_hdr.msg_control = controls[i];
+            messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+    }
+    int result;
+    do // Reporting a refused datagram clears the error
+        result = recvmmsg(handle, messages, datagramBatchSize, MSG_DONTWAIT, NULL);
+    while(result == -1 && refusedDatagram(lastError()));
+    if(result == -1) {
+        if(wouldBlock())
+            return 0;
+        throw Exception(Exception::ERROR_READ);
+    }
+    for(count = 0; count < result; ++count) {
+        lengths[count] = messages[count].msg_len;
+        segments[count] = 0;
+        datagramSenders[count].addressLength = messages[count].msg_hdr.msg_namelen;
+        #ifdef UDP_GRO
+        for(struct cmsghdr* control = CMSG_FIRSTHDR(&messages[count].msg_hdr); control;
+            control = CMSG_NXTHDR(&messages[count].msg_hdr, control))
+            if(control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO) {
+                int segmentSize;
+                memcpy(&segmentSize, CMSG_DATA(control), sizeof(segmentSize));
+                segments[count] = segmentSize;
+            }
+        #endif
+    }
+    #else
+    // Without recvmmsg at least the polling is saved
+    for(; count < datagramBatchSize; ++count) {
+        lengths[count] = receive(&datagramBuffers[count*packetSize], packetSize);
+        if(lengths[count] == 0)
+            break;
+        segments[count] = 0;
+        datagramSenders[count] = remoteEndpoint;
+    }
+    #endif
+    // Let the socket read from one packet or segment at a time
+    for(std::streamsize i = 0; i < count && handle != -1; ++i) {
+        char_type* packet = &datagramBuffers[i*packetSize];
+        std::streamsize segmentSize = (segments[i] > 0) ? segments[i] : lengths[i];
+        receiveSegmentSize = segments[i];
+        for(std::streamsize offset = 0; offset < lengths[i] && handle != -1; offset += segmentSize) {
+            setg(packet+offset, packet+offset, packet+std::min(offset+segmentSize, lengths[i]));
+            if(!remoteConnected)
+                setDatagramSender(datagramSenders[i]);
+            onReadable();
+        }
+    }
+    if(handle != -1) {
+        receiveSegmentSize = 0;
+        setg(inputIntermediateBuffer, inputIntermediateBuffer, inputIntermediateBuffer);
+    }
+    return count;
+}
+
+void Socket::sendDatagrams() {
+    if(status != READY && status != BUSY)
+        return;
+    std::streamsize offset = 0;
+    for(size_t i = 0; i < queuedSent; ++i)
+        offset += queuedDestinations[i].second;
+    while(queuedSent < queuedDestinations.size()) {
+        #ifdef __linux__
+        struct mmsghdr messages[NETLINK_MAX_DATAGRAM_BATCH_SIZE];
+        struct iovec vectors[NETLINK_MAX_DATAGRAM_BATCH_SIZE];
+        unsigned int count = 0;
+        std::streamsize position = offset;
+        for(; count < NETLINK_MAX_DATAGRAM_BATCH_SIZE && queuedSent+count < queuedDestinations.size(); ++count) {
+            const auto& destination = queuedDestinations[queuedSent+count];
+            vectors[count].iov_base = &queuedDatagrams[position];
+            vectors[count].iov_len = destination.second;
+            memset(&messages[count].msg_hdr, 0, sizeof(messages[count].msg_hdr));
+            messages[count].msg_hdr.msg_iov = &vectors[count];
+            messages[count].msg_hdr.msg_iovlen = 1;
+            messages[count].msg_hdr.msg_name = const_cast<struct sockaddr_storage*>(&destination.first.address);
+            messages[count].msg_hdr.msg_namelen = destination.first.addressLength;
+            position += destination.second;
+        }
+        int result = sendmmsg(handle, messages, count, MSG_DONTWAIT);
+        if(result <= 0) {
+            if(wouldBlock()) {
+                status = BUSY;
+                return;
+            }
+            // The error belongs to an earlier datagram, try again
+            if(result == -1 && refusedDatagram(lastError()))
+                continue;
+            // Drop the datagram which can not be sent, like the network would
+            result = 1;
+        }
+        for(int i = 0; i < result; ++i)
+            offset += queuedDestinations[queuedSent++].second;
+        #else
+        const auto& destination = queuedDestinations[queuedSent];
+        try {
+            if(sendTo(destination.first, &queuedDatagrams[offset], destination.second) == 0)
+                return;
+        } catch(Exception err) {
+            // Drop the datagram which can not be sent, like the network would
+        }
+        offset += destination.second;
+        ++queuedSent;
+        #endif
+    }
+    status = READY;
+    queuedDatagrams.clear();
+    queuedDestinations.clear();
+    queuedSent = 0;
 }
 
 void Socket::initAsTcpClient(const std::string& _hostRemote, unsigned _portRemote, bool waitUntilConnected) {
@@ -319,8 +910,15 @@ void Socket::initAsUdpPeer(const std::string& _hostLocal, unsigned _portLocal) {
     initSocket(false);
 }
 
-Socket::Socket() :ipVersion(ANY), type(NONE), status(NOT_CONNECTED),
-    handle(-1), portLocal(0), portRemote(0) { }
+Socket::Socket() :inputIntermediateSize(0), inputIntermediateBuffer(NULL), inputMirrored(false), inputPooled(false),
+    outputIntermediateSize(0), outputIntermediateBuffer(NULL), outputMirrored(false), outputPooled(false), ipVersion(ANY), type(NONE), status(NOT_CONNECTED),
+    handle(-1), manager(NULL), flushScheduled(false), pollSlot(0), set(NULL), setIndex(0), setCount(0),
+    remoteEndpointPort(0), remoteFormatted(false), remoteConnected(false),
+    datagramBatchSize(1), queuedSent(0), receiveOffload(false), receiveSegmentSize(0),
+    zeroCopyThreshold(0), zeroCopySent(0), zeroCopyCompleted(0), splicePipe{-1, -1}, splicePending(0), receivePaused(false),
+    connectTimeout(0.0), idleTimeout(0.0), timeoutTimer(0), lastActivity(0),
+    adaptiveMinSize(0), adaptiveMaxSize(0), inputFullCount(0), outputFullCount(0), shrinkTimer(0),
+    resolving(false), attemptOf(NULL), attemptTimer(0), connectStart(0), portLocal(0), portRemote(0) { }
 
 Socket::~Socket() {
     disconnect();
@@ -341,6 +939,30 @@ Socket::Status Socket::getStatus() const {
         return (Socket::Status)status;
 }
 
+const std::string& Socket::getHostRemote() const {
+    return hostRemote;
+}
+
+unsigned int Socket::getPortRemote() const {
+    return portRemote;
+}
+
+void Socket::setDatagramSender(const Endpoint& sender) {
+    // Formatting is skipped as long as the same peer keeps sending and hostRemote and portRemote were not changed
+    if(remoteFormatted && sender == remoteEndpoint &&
+       hostRemote == remoteEndpointHost && portRemote == remoteEndpointPort)
+        return;
+    remoteEndpoint = sender;
+    readSockaddr(&remoteEndpoint.address, hostRemote, portRemote);
+    remoteEndpointHost = hostRemote;
+    remoteEndpointPort = portRemote;
+    remoteFormatted = true;
+}
+
+const Endpoint& Socket::getRemoteEndpoint() const {
+    return remoteEndpoint;
+}
+
 std::streamsize Socket::showmanyc() {
     #ifdef WINVER
     unsigned long result = 0;
@@ -358,19 +980,33 @@ std::streamsize Socket::showmanyc() {
 std::streamsize Socket::advanceInputBuffer() {
     if(getInputBufferSize() == 0) // No input buffer
         return 0;
+    borrowInputBuffer();
     std::streamsize inAvail;
     if(type == UDP_PEER)
         inAvail = 0;
     else {
         inAvail = egptr()-gptr();
-        memmove(eback(), gptr(), inAvail);
-    }
-    try {
-        inAvail += receive(eback()+inAvail, getInputBufferSize()-inAvail);
-    } catch(Exception err) {
-
+        if(inputMirrored) { // Move the get area along the ring buffer
+            char_type* begin = gptr();
+            if(begin >= inputIntermediateBuffer+inputIntermediateSize)
+                begin -= inputIntermediateSize;
+            setg(begin, begin, begin+inAvail);
+        } else
+            memmove(eback(), gptr(), inAvail);
     }
     setg(eback(), eback(), eback()+inAvail);
+    inAvail += receive(eback()+inAvail, getInputBufferSize()-inAvail);
+    setg(eback(), eback(), eback()+inAvail);
+    if(adaptiveMaxSize > 0) {
+        // Receives which fill the buffer again and again mean that it is too small
+        inputFullCount = (inAvail == getInputBufferSize()) ? inputFullCount+1 : 0;
+        if(inputFullCount >= NETLINK_BUFFER_GROW_COUNT && getInputBufferSize() < adaptiveMaxSize) {
+            inputFullCount = 0;
+            setInputBufferSize(std::min(2*getInputBufferSize(), adaptiveMaxSize));
+            if(manager)
+                manager->scheduleShrink(this);
+        }
+    }
     return inAvail;
 }
 
@@ -379,30 +1015,41 @@ std::streamsize Socket::receive(char_type* buffer, std::streamsize size) {
         throw Exception(Exception::BAD_TYPE);
     if(status != Socket::Status::READY && status != Socket::Status::BUSY)
         return 0;
-    size = std::min(size, showmanyc());
     if(size == 0)
         return 0;
     switch(type) {
         case UDP_PEER: {
-            struct sockaddr_storage remoteAddr;
+            // Reads one datagram, the rest of it is discarded if it does not fit into buffer
+            Endpoint sender;
+            socklen_t addrSize;
+            int result;
+            do { // Reporting a refused datagram clears the error
+                addrSize = sizeof(sender.address);
+                result = (remoteConnected)
+                    ? recv(handle, (char*)buffer, size, 0)
+                    : recvfrom(handle, (char*)buffer, size, 0, reinterpret_cast<struct sockaddr*>(&sender.address), &addrSize);
+            } while(result == -1 && refusedDatagram(lastError()));
             #ifdef WINVER
-            int addrSize = sizeof(remoteAddr);
-            #else
-            unsigned int addrSize = sizeof(remoteAddr);
+            if(result == -1 && WSAGetLastError() == WSAEMSGSIZE)
+                result = size;
             #endif
-            int result = recvfrom(handle, (char*)buffer, size, 0, reinterpret_cast<struct sockaddr*>(&remoteAddr), &addrSize);
-            if(result <= 0) {
-                portRemote = 0;
-                hostRemote = "";
+            if(result == -1) {
+                if(wouldBlock())
+                    return 0;
                 throw Exception(Exception::ERROR_READ);
-            } else
-                readSockaddr(&remoteAddr, hostRemote, portRemote);
+            }
+            if(!remoteConnected) {
+                sender.addressLength = addrSize;
+                setDatagramSender(sender);
+            }
             return result;
         }
         case TCP_CLIENT:
         case TCP_SERVERS_CLIENT: {
             int result = recv(handle, (char*)buffer, size, 0);
-            if(result <= 0)
+            if(result == -1 && wouldBlock())
+                return 0;
+            if(result <= 0) // 0 means the connection was closed
                 throw Exception(Exception::ERROR_READ);
             return result;
         }
@@ -419,26 +1066,34 @@ std::streamsize Socket::send(const char_type* buffer, std::streamsize size) {
     if(status != Socket::Status::READY || size == 0)
         return 0;
     switch(type) {
-        case UDP_PEER: {
-            AddrinfoContainer info = getSocketInfoFor(hostRemote.c_str(), portRemote, false);
-            size_t sentBytes = 0;
-            while(sentBytes < (size_t)size) {
-                int result = ::sendto(handle, (const char*)buffer + sentBytes, size - sentBytes, 0, info->ai_addr, info->ai_addrlen);
-                if(result <= 0) {
-                    status = BUSY;
-                    throw Exception(Exception::ERROR_SEND);
+        case UDP_PEER:
+            if(!remoteConnected) {
+                // Send to the sender of the last datagram or only resolve again if hostRemote or portRemote changed
+                if(!remoteEndpoint.isValid() || remoteEndpointPort != portRemote || remoteEndpointHost != hostRemote) {
+                    remoteEndpoint = resolve(hostRemote, portRemote);
+                    remoteEndpointHost = hostRemote;
+                    remoteEndpointPort = portRemote;
+                    remoteFormatted = false;
                 }
-                sentBytes += result;
+                return sendTo(remoteEndpoint, buffer, size);
             }
-            return sentBytes;
-        }
+            // Connected UDP_PEER sends like TCP
+            /* fallthrough */
         case TCP_CLIENT:
         case TCP_SERVERS_CLIENT: {
             size_t sentBytes = 0;
             while(sentBytes < (size_t)size) {
                 int result = ::send(handle, (const char*)buffer + sentBytes, size - sentBytes, 0);
+                // The error belongs to an earlier datagram of a connected UDP_PEER, try again
+                if(result == -1 && type == UDP_PEER && refusedDatagram(lastError()))
+                    continue;
                 if(result <= 0) {
                     status = BUSY;
+                    if(wouldBlock()) {
+                        // Poll for writability, even without pending output
+                        flushLater();
+                        break;
+                    }
                     throw Exception(Exception::ERROR_SEND);
                 }
                 sentBytes += result;
@@ -452,18 +1107,186 @@ std::streamsize Socket::send(const char_type* buffer, std::streamsize size) {
     }
 }
 
+Endpoint Socket::resolve(const std::string& _hostRemote, unsigned _portRemote) {
+    if(type != UDP_PEER)
+        throw Exception(Exception::BAD_TYPE);
+    return getSocketInfoFor(_hostRemote.c_str(), _portRemote, false).front();
+}
+
+std::streamsize Socket::sendTo(const Endpoint& endpoint, const char_type* buffer, std::streamsize size) {
+    if(type != UDP_PEER)
+        throw Exception(Exception::BAD_TYPE);
+    if((status != READY && status != BUSY) || size == 0)
+        return 0;
+    if(!endpoint.isValid())
+        throw Exception(Exception::ERROR_RESOLVING_ADDRESS);
+    int result;
+    do // The error of a refused earlier datagram is reported here, try again
+        result = ::sendto(handle, (const char*)buffer, size, 0, reinterpret_cast<const struct sockaddr*>(&endpoint.address), endpoint.addressLength);
+    while(result == -1 && refusedDatagram(lastError()));
+    if(result <= 0) {
+        status = BUSY;
+        if(wouldBlock()) {
+            flushLater();
+            return 0;
+        }
+        throw Exception(Exception::ERROR_SEND);
+    }
+    status = READY;
+    return result;
+}
+
+void Socket::queueDatagram(const Endpoint& endpoint, const char_type* buffer, std::streamsize size) {
+    if(type != UDP_PEER)
+        throw Exception(Exception::BAD_TYPE);
+    if(!endpoint.isValid())
+        throw Exception(Exception::ERROR_RESOLVING_ADDRESS);
+    queuedDatagrams.insert(queuedDatagrams.end(), buffer, buffer+size);
+    queuedDestinations.push_back(std::make_pair(endpoint, size));
+    flushLater();
+}
+
+void Socket::setDatagramBatchSize(unsigned int count) {
+    if(type != UDP_PEER)
+        throw Exception(Exception::BAD_TYPE);
+    datagramBatchSize = std::max(1U, std::min(count, static_cast<unsigned int>(NETLINK_MAX_DATAGRAM_BATCH_SIZE)));
+}
+
+void Socket::setSegmentationOffload(unsigned int segmentSize) {
+    if(type != UDP_PEER)
+        throw Exception(Exception::BAD_TYPE);
+    #if defined(__linux__) && defined(UDP_SEGMENT)
+    int value = segmentSize;
+    if(setsockopt(handle, SOL_UDP, UDP_SEGMENT, &value, sizeof(value)) == -1)
+        throw Exception(Exception::ERROR_SET_SOCK_OPT);
+    #else
+    if(segmentSize > 0)
+        throw Exception(Exception::ERROR_SET_SOCK_OPT);
+    #endif
+}
+
+void Socket::setZeroCopyThreshold(std::streamsize bytes) {
+    if(type != TCP_CLIENT && type != TCP_SERVERS_CLIENT)
+        throw Exception(Exception::BAD_TYPE);
+    #if defined(__linux__) && defined(MSG_ZEROCOPY)
+    int value = 1;
+    if(bytes > 0 && setsockopt(handle, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == -1)
+        throw Exception(Exception::ERROR_SET_SOCK_OPT);
+    zeroCopyThreshold = bytes;
+    #else
+    if(bytes > 0)
+        throw Exception(Exception::ERROR_SET_SOCK_OPT);
+    #endif
+}
+
+void Socket::setReceiveOffload(bool enable) {
+    if(type != UDP_PEER)
+        throw Exception(Exception::BAD_TYPE);
+    #if defined(__linux__) && defined(UDP_GRO)
+    int value = enable;
+    if(setsockopt(handle, SOL_UDP, UDP_GRO, &value, sizeof(value)) == -1)
+        throw Exception(Exception::ERROR_SET_SOCK_OPT);
+    // A coalesced datagram can be as large as the biggest UDP payload
+    if(enable && getInputBufferSize() < 65535)
+        setInputBufferSize(65535);
+    receiveOffload = enable;
+    #else
+    if(enable)
+        throw Exception(Exception::ERROR_SET_SOCK_OPT);
+    #endif
+}
+
+void Socket::connectUdpPeer(const std::string& _hostRemote, unsigned _portRemote) {
+    remoteEndpoint = resolve(_hostRemote, _portRemote);
+    if(connect(handle, reinterpret_cast<const struct sockaddr*>(&remoteEndpoint.address), remoteEndpoint.addressLength) == -1)
+        throw Exception(Exception::ERROR_INIT);
+    hostRemote = remoteEndpointHost = _hostRemote;
+    portRemote = remoteEndpointPort = _portRemote;
+    remoteFormatted = false;
+    remoteConnected = true;
+}
+
+std::streamsize Socket::sendSplicePipe() {
+    #ifdef __linux__
+    while(splicePending > 0 && status == READY) {
+        ssize_t result = splice(splicePipe[0], NULL, handle, NULL, splicePending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(result <= 0) {
+            status = BUSY;
+            if(wouldBlock())
+                break;
+            throw Exception(Exception::ERROR_SEND);
+        }
+        splicePending -= result;
+    }
+    #endif
+    return splicePending;
+}
+
+std::streamsize Socket::spliceTo(Socket* destination) {
+    std::streamsize size = 0;
+    #ifdef __linux__
+    if(destination->splicePipe[0] == -1 && pipe2(destination->splicePipe, O_NONBLOCK | O_CLOEXEC) == -1)
+        throw Exception(Exception::ERROR_SEND);
+    // Data which was received already goes into the pipe first
+    std::streamsize length = egptr()-gptr();
+    if(length > 0) {
+        ssize_t result = write(destination->splicePipe[1], gptr(), length);
+        if(result > 0) {
+            gbump(result);
+            destination->splicePending += result;
+            size += result;
+        }
+    }
+    while(egptr() == gptr()) {
+        destination->sendSplicePipe();
+        ssize_t result = splice(handle, NULL, destination->splicePipe[1], NULL, NETLINK_SPLICE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(result <= 0) // Nothing left or the pipe is full, a closed connection is detected by the next read
+            break;
+        destination->splicePending += result;
+        size += result;
+    }
+    if(destination->sendSplicePipe() > 0) {
+        // Continue once the destination can send again
+        destination->spliceSource = shared_from_this();
+        // Otherwise the unread data would be reported as readable again and again
+        if(manager)
+            manager->pauseReceiving(this, true);
+        destination->flushLater();
+    }
+    #endif
+    return size;
+}
+
 std::streamsize Socket::redirect(const std::vector<std::shared_ptr<Socket>>& destinations) {
     if(type == TCP_SERVER)
         throw Exception(Exception::BAD_TYPE);
     std::streamsize size = 0;
-    while(in_avail()) {
-        auto length = egptr()-gptr();
+    #ifdef __linux__
+    Socket* destination = (destinations.size() == 1) ? destinations[0].get() : NULL;
+    if((type == TCP_CLIENT || type == TCP_SERVERS_CLIENT) && destination && destination->getOutputBufferSize() > 0 &&
+       (destination->type == TCP_CLIENT || destination->type == TCP_SERVERS_CLIENT)) {
+        // The pipe is sent before the output intermediate buffer, so that has to be empty
+        destination->pubsync();
+        if(destination->getOutputBufferPending() == 0 && destination->outputReferences.empty())
+            return spliceTo(destination);
+    }
+    #endif
+    while(true) {
+        std::streamsize length = egptr()-gptr();
+        if(length == 0) {
+            try {
+                length = advanceInputBuffer();
+            } catch(Exception err) {
+                break;
+            }
+            if(length == 0)
+                break;
+        }
         for(const auto& destination : destinations)
             if(destination->sputn(gptr(), length) < length)
                 throw Exception(Exception::ERROR_SEND);
         gbump(length);
         size += length;
-        advanceInputBuffer();
     }
     return size;
 }
@@ -473,28 +1296,146 @@ std::streamsize Socket::getInputBufferSize() {
 }
 
 std::streamsize Socket::getOutputBufferSize() {
-    return epptr()-pbase();
+    return outputIntermediateSize;
+}
+
+std::streamsize Socket::getOutputBufferPending() {
+    return pptr()-pbase();
 }
 
 void Socket::setInputBufferSize(std::streamsize n) {
-    if(eback()) delete[] eback();
-    if(type != TCP_SERVER && n > 0) {
-        char_type* readBuffer = new char_type[n];
-        setg(readBuffer, readBuffer, readBuffer);
-        inputIntermediateSize = n;
-    } else {
-        setg(NULL, NULL, NULL);
-        inputIntermediateSize = 0;
+    // Unread contents move into the new buffer
+    char_type* unread = gptr();
+    std::streamsize unreadSize = egptr()-gptr();
+    if(n > 0 && n < unreadSize)
+        n = unreadSize;
+    char_type* prevBuffer = inputIntermediateBuffer;
+    std::streamsize prevSize = inputIntermediateSize;
+    bool prevMirrored = inputMirrored, prevPooled = inputPooled;
+    inputPooled = false;
+    inputMirrored = false;
+    if(type != TCP_SERVER && n > 0 && bufferPool && static_cast<size_t>(n) == bufferPool->getBufferSize()) {
+        // Borrowed when data is received
+        inputIntermediateBuffer = (unreadSize > 0) ? bufferPool->acquire() : NULL;
+        inputPooled = true;
+    } else if(type != TCP_SERVER && n > 0)
+        inputIntermediateBuffer = allocateBuffer(n, type != UDP_PEER, inputMirrored);
+    else {
+        inputIntermediateBuffer = NULL;
+        n = 0;
     }
+    inputIntermediateSize = n;
+    if(inputIntermediateBuffer) {
+        if(unreadSize > 0)
+            memcpy(inputIntermediateBuffer, unread, unreadSize);
+        setg(inputIntermediateBuffer, inputIntermediateBuffer, inputIntermediateBuffer+unreadSize);
+    } else
+        setg(NULL, NULL, NULL);
+    if(prevPooled) {
+        if(prevBuffer)
+            bufferPool->release(prevBuffer);
+    } else if(prevBuffer)
+        freeBuffer(prevBuffer, prevSize, prevMirrored);
 }
 
 void Socket::setOutputBufferSize(std::streamsize n) {
-    if(pbase()) delete[] pbase();
-    if(type != TCP_SERVER && n > 0) {
-        char_type* writeBuffer = new char_type[n];
-        setp(writeBuffer, writeBuffer+n);
+    // Unsent contents move into the new buffer, referenced output stays behind the same offsets
+    char_type* unsent = pbase();
+    std::streamsize unsentSize = pptr()-pbase();
+    if(n > 0 && n < unsentSize)
+        n = unsentSize;
+    char_type* prevBuffer = outputIntermediateBuffer;
+    std::streamsize prevSize = outputIntermediateSize;
+    bool prevMirrored = outputMirrored, prevPooled = outputPooled;
+    outputPooled = false;
+    outputMirrored = false;
+    if(type != TCP_SERVER && n > 0 && bufferPool && static_cast<size_t>(n) == bufferPool->getBufferSize()) {
+        // Borrowed when data is written
+        outputIntermediateBuffer = (unsentSize > 0) ? bufferPool->acquire() : NULL;
+        outputPooled = true;
+    } else if(type != TCP_SERVER && n > 0)
+        outputIntermediateBuffer = allocateBuffer(n, type != UDP_PEER, outputMirrored);
+    else {
+        outputIntermediateBuffer = NULL;
+        n = 0;
+    }
+    outputIntermediateSize = n;
+    if(outputIntermediateBuffer) {
+        if(unsentSize > 0)
+            memcpy(outputIntermediateBuffer, unsent, unsentSize);
+        setp(outputIntermediateBuffer, outputIntermediateBuffer+n);
+        pbump(unsentSize);
+        fitPutArea();
     } else
         setp(NULL, NULL);
+    if(prevPooled) {
+        if(prevBuffer)
+            bufferPool->release(prevBuffer);
+    } else if(prevBuffer)
+        freeBuffer(prevBuffer, prevSize, prevMirrored);
+}
+
+void Socket::setAdaptiveBufferSize(std::streamsize minSize, std::streamsize maxSize) {
+    if(type != TCP_CLIENT && type != TCP_SERVER && type != TCP_SERVERS_CLIENT)
+        throw Exception(Exception::BAD_TYPE);
+    adaptiveMinSize = minSize;
+    adaptiveMaxSize = (maxSize > 0) ? std::max(minSize, maxSize) : 0;
+    inputFullCount = outputFullCount = 0;
+    if(type == TCP_SERVER)
+        return;
+    setInputBufferSize(minSize);
+    setOutputBufferSize(minSize);
+    // Large buffers are rounded up to whole pages
+    adaptiveMinSize = std::min(getInputBufferSize(), getOutputBufferSize());
+}
+
+bool Socket::shrinkBuffers() {
+    if(getInputBufferSize() > adaptiveMinSize && egptr()-gptr() <= adaptiveMinSize)
+        setInputBufferSize(adaptiveMinSize);
+    if(getOutputBufferSize() > adaptiveMinSize && getOutputBufferPending() <= adaptiveMinSize)
+        setOutputBufferSize(adaptiveMinSize);
+    return getInputBufferSize() > adaptiveMinSize || getOutputBufferSize() > adaptiveMinSize;
+}
+
+void Socket::borrowInputBuffer() {
+    if(!inputPooled || inputIntermediateBuffer)
+        return;
+    inputIntermediateBuffer = bufferPool->acquire();
+    setg(inputIntermediateBuffer, inputIntermediateBuffer, inputIntermediateBuffer);
+}
+
+void Socket::borrowOutputBuffer() {
+    if(!outputPooled || outputIntermediateBuffer)
+        return;
+    outputIntermediateBuffer = bufferPool->acquire();
+    setp(outputIntermediateBuffer, outputIntermediateBuffer+outputIntermediateSize);
+    fitPutArea();
+}
+
+void Socket::returnIdleBuffers() {
+    if(inputPooled && inputIntermediateBuffer && egptr() == gptr()) {
+        bufferPool->release(inputIntermediateBuffer);
+        inputIntermediateBuffer = NULL;
+        setg(NULL, NULL, NULL);
+    }
+    // Referenced output is positioned relative to the put area
+    if(outputPooled && outputIntermediateBuffer && pptr() == pbase() && outputReferences.empty()) {
+        bufferPool->release(outputIntermediateBuffer);
+        outputIntermediateBuffer = NULL;
+        setp(NULL, NULL);
+    }
+}
+
+void Socket::setConnectTimeout(double seconds) {
+    connectTimeout = seconds;
+    if(manager)
+        manager->updateTimeout(this);
+}
+
+void Socket::setIdleTimeout(double seconds) {
+    idleTimeout = seconds;
+    if(manager)
+        manager->updateTimeout(this);
 }
 
 void Socket::setBlockingMode(bool blocking) {
@@ -561,7 +1502,12 @@ std::shared_ptr<Socket> Socket::accept() {
     #else
     unsigned int addrSize = sizeof(remoteAddr);
     #endif
+    #ifdef __linux__
+    // Saves the fcntl() calls of setBlockingMode()
+    int clientHandle = ::accept4(handle, reinterpret_cast<struct sockaddr*>(&remoteAddr), &addrSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    #else
     int clientHandle = ::accept(handle, reinterpret_cast<struct sockaddr*>(&remoteAddr), &addrSize);
+    #endif
     if(clientHandle == -1) return nullptr;
     std::shared_ptr<Socket> client = SocketFactory();
     client->ipVersion = ipVersion;
@@ -571,29 +1517,79 @@ std::shared_ptr<Socket> Socket::accept() {
     client->hostLocal = hostLocal;
     client->portLocal = portLocal;
     readSockaddr(&remoteAddr, client->hostRemote, client->portRemote);
-    client->setInputBufferSize(NETLINK_DEFAULT_INPUT_BUFFER_SIZE);
-    client->setOutputBufferSize(NETLINK_DEFAULT_OUTPUT_BUFFER_SIZE);
+    client->bufferPool = bufferPool;
+    if(adaptiveMaxSize > 0)
+        client->setAdaptiveBufferSize(adaptiveMinSize, adaptiveMaxSize);
+    else {
+        client->setInputBufferSize(NETLINK_DEFAULT_INPUT_BUFFER_SIZE);
+        client->setOutputBufferSize(NETLINK_DEFAULT_OUTPUT_BUFFER_SIZE);
+    }
+    #ifndef __linux__
     client->setBlockingMode(false);
+    #endif
+    client->manager = manager;
+    client->idleTimeout = idleTimeout;
     clients.insert(client);
+    if(manager)
+        manager->watch(client, this);
     return client;
 }
 
 void Socket::disconnect() {
-    if(handle == -1)
+    // Without a handle it might still be resolving
+    if(handle == -1 && status == NOT_CONNECTED)
         return;
+    if(manager) {
+        // Without a slot releaseSockets() would not remove it from the managed sockets
+        if(resolving)
+            manager->releaseUnwatched(this);
+        manager->unwatch(this);
+        manager->cancelAttempts(this);
+    }
+    resolving = false;
+    connectStart = 0;
+    for(const auto& client : clients)
+        client->disconnect();
     ipVersion = ANY;
     type = NONE;
     status = NOT_CONNECTED;
     setInputBufferSize(0);
     setOutputBufferSize(0);
     clients.clear();
+    remoteEndpoint = Endpoint();
+    remoteFormatted = false;
+    remoteConnected = false;
+    datagramBatchSize = 1;
+    datagramBuffers.clear();
+    queuedDatagrams.clear();
+    queuedDestinations.clear();
+    queuedSent = 0;
+    outputReferences.clear();
+    zeroCopyThreshold = 0;
+    zeroCopySent = zeroCopyCompleted = 0;
+    adaptiveMinSize = adaptiveMaxSize = 0;
+    inputFullCount = outputFullCount = 0;
+    #ifdef __linux__
+    if(splicePipe[0] != -1) {
+        close(splicePipe[0]);
+        close(splicePipe[1]);
+        splicePipe[0] = splicePipe[1] = -1;
+    }
+    #endif
+    splicePending = 0;
+    // The source would never be polled for readability again
+    std::shared_ptr<Socket> source = spliceSource.lock();
+    if(source && source->manager)
+        source->manager->pauseReceiving(source.get(), false);
+    spliceSource.reset();
+    receivePaused = false;
+    receiveOffload = false;
+    receiveSegmentSize = 0;
     closesocket(handle);
     handle = -1;
 }
 
-void Socket::disconnectOnError() {
-    if(status == NOT_CONNECTED)
-        return;
+int Socket::takeError() {
     int error;
     #ifdef WINVER
     int length = sizeof(error);
@@ -602,8 +1598,97 @@ void Socket::disconnectOnError() {
     socklen_t length = sizeof(error);
     getsockopt(handle, SOL_SOCKET, SO_ERROR, &error, &length);
     #endif
-    if(error != 0)
+    return error;
+}
+
+void Socket::disconnectOnError() {
+    if(status == NOT_CONNECTED)
+        return;
+    int error = takeError();
+    // A refused datagram (ICMP port unreachable) does not break a connectionless socket
+    if(error != 0 && !(type == UDP_PEER && refusedDatagram(error)))
         disconnect();
 }
 
+
+
+size_t SocketSet::indexOf(const Socket* socket) const {
+    if(socket->set == this)
+        return socket->setIndex;
+    // Only search if the socket is in another set than the one owning its index
+    if(socket->setCount == ((socket->set) ? 1U : 0U))
+        return items.size();
+    for(size_t index = 0; index < items.size(); ++index)
+        if(items[index].get() == socket)
+            return index;
+    return items.size();
+}
+
+SocketSet::SocketSet(const SocketSet& other) :manager(NULL) {
+    *this = other;
+}
+
+SocketSet& SocketSet::operator=(const SocketSet& other) {
+    if(this == &other)
+        return *this;
+    clear();
+    items = other.items;
+    for(const auto& socket : items)
+        ++socket->setCount;
+    if(manager)
+        for(const auto& socket : items)
+            manager->adopt(socket);
+    return *this;
+}
+
+SocketSet::~SocketSet() {
+    clear();
+}
+
+size_t SocketSet::count(const std::shared_ptr<Socket>& socket) const {
+    return (indexOf(socket.get()) < items.size()) ? 1 : 0;
+}
+
+void SocketSet::insert(const std::shared_ptr<Socket>& socket) {
+    if(count(socket))
+        return;
+    if(!socket->set) {
+        socket->set = this;
+        socket->setIndex = items.size();
+    }
+    ++socket->setCount;
+    items.push_back(socket);
+    if(manager)
+        manager->adopt(socket);
+}
+
+void SocketSet::erase(const std::shared_ptr<Socket>& socket) {
+    size_t index = indexOf(socket.get());
+    if(index == items.size())
+        return;
+    if(socket->set == this)
+        socket->set = NULL;
+    --socket->setCount;
+    if(index+1 < items.size()) {
+        items[index] = std::move(items.back());
+        if(items[index]->set == this)
+            items[index]->setIndex = index;
+    }
+    items.pop_back();
+    if(manager)
+        manager->abandon(socket);
+}
+
+void SocketSet::clear() {
+    std::vector<std::shared_ptr<Socket>> removed;
+    removed.swap(items);
+    for(const auto& socket : removed) {
+        if(socket->set == this)
+            socket->set = NULL;
+        --socket->setCount;
+        if(manager)
+            manager->abandon(socket);
+    }
+}
+
 };
@@ -18,168 +18,721 @@
 
 #include "netLink.h"
 
-#define foreach_e(c, i) for(auto end##i = (c).end(), next##i = (c).begin(), \
-    i = (next##i==end##i)?end##i:next##i++; \
-    i != next##i; \
-    i = (next##i==end##i)?end##i:next##i++)
+#ifdef NETLINK_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#endif
 
-#define checkSocketStillValid(socketsSet, iterator, socket) \
-    if(socket->status == Socket::Status::NOT_CONNECTED) { \
-        socketsSet.erase(*iterator); \
-        continue; \
+namespace netLink {
+
+#define watchToken(entry) \
+    ((static_cast<uint64_t>((entry).generation) << 32) | (entry).socket->pollSlot)
+
+//! Token of the wakeup handle of the resolver, which never matches a slot
+#define wakeupToken UINT64_MAX
+
+#define epollEvents(interest) \
+    (((interest & SocketManager::READABLE) ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0U) | \
+    ((interest & SocketManager::WRITABLE) ? static_cast<uint32_t>(EPOLLOUT) : 0U))
+
+//! Returns the current tick of the timers in milliseconds
+static uint64_t currentTick() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//! Converts a duration in seconds to ticks
+static uint64_t secondsToTicks(double seconds) {
+    return (seconds > 0.0) ? static_cast<uint64_t>(std::ceil(seconds*1000.0)) : 0;
+}
+
+SocketManager::SocketManager() :watchedCount(0), ring(NULL), generation(0), timers(currentTick()), wakeupArmed(false),
+    acceptBatchSize(NETLINK_DEFAULT_ACCEPT_BATCH_SIZE) {
+    sockets.manager = this;
+    #ifdef NETLINK_IO_URING
+    pollHandle = -1;
+    ring = new IoUring(NETLINK_MAX_POLL_EVENTS);
+    #elif defined(__linux__)
+    pollHandle = epoll_create1(EPOLL_CLOEXEC);
+    if(pollHandle == -1)
+        throw Exception(Exception::ERROR_INIT);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = wakeupToken;
+    if(epoll_ctl(pollHandle, EPOLL_CTL_ADD, resolver.getWakeupHandle(), &event) == -1) {
+        close(pollHandle);
+        throw Exception(Exception::ERROR_INIT);
     }
+    #endif
+}
 
-#define removeSocket() { \
-    if(onStatusChange) onStatusChange(this, *iterator, prev); \
-    sockets.erase(*iterator); \
-    selection.erase(*iterator); \
-    continue; \
+SocketManager::~SocketManager() {
+    sockets.manager = NULL;
+    for(const auto& socket : sockets)
+        socket->manager = NULL;
+    for(const auto& entry : watched)
+        if(entry.socket)
+            entry.socket->manager = NULL;
+    #ifdef NETLINK_IO_URING
+    delete ring;
+    #elif defined(__linux__)
+    close(pollHandle);
+    #endif
 }
 
-#define forEachSocket() \
-    Socket* socket = (*iterator).get(); \
-    MsgPackSocket* msgPackSocket = dynamic_cast<MsgPackSocket*>(socket); \
-    Socket::Status prev = socket->getStatus(); \
-    socket->disconnectOnError(); \
-    if(socket->getStatus() == Socket::Status::NOT_CONNECTED) \
-        removeSocket()
+SocketManager::Watch* SocketManager::getWatch(uint64_t token) {
+    uint32_t slot = static_cast<uint32_t>(token);
+    if(slot >= watched.size())
+        return NULL;
+    Watch& entry = watched[slot];
+    return (entry.generation != 0 && entry.generation == (token >> 32)) ? &entry : NULL;
+}
 
-namespace netLink {
+SocketManager::Watch* SocketManager::getWatch(Socket* socket) {
+    if(socket->pollSlot >= watched.size())
+        return NULL;
+    Watch& entry = watched[socket->pollSlot];
+    return (entry.generation != 0 && entry.socket.get() == socket) ? &entry : NULL;
+}
 
-std::shared_ptr<Socket> SocketManager::newSocket() {
-    std::shared_ptr<Socket> socket(new Socket());
-    sockets.insert(socket);
-    return socket;
+void SocketManager::watch(std::shared_ptr<Socket> socket, Socket* server) {
+    uint32_t slot;
+    if(freeSlots.empty()) {
+        slot = watched.size();
+        watched.push_back(Watch());
+    } else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    Watch& entry = watched[slot];
+    entry.socket = socket;
+    if(server)
+        entry.server = server->shared_from_this();
+    entry.interest = READABLE;
+    socket->receivePaused = false;
+    if(socket->status == Socket::Status::CONNECTING)
+        entry.interest |= WRITABLE;
+    if(++generation == 0) // Generation 0 marks free and released slots
+        ++generation;
+    entry.generation = generation;
+    entry.armed = false;
+    socket->pollSlot = slot;
+    socket->flushScheduled = false;
+    socket->timeoutTimer = 0;
+    socket->attemptTimer = 0;
+    socket->lastActivity = currentTick();
+    if(socket->status == Socket::Status::CONNECTING && socket->connectStart == 0)
+        socket->connectStart = socket->lastActivity;
+    ++watchedCount;
+    updateTimeout(socket.get());
+    scheduleAttempt(socket.get());
+    #ifdef NETLINK_IO_URING
+    armPoll(entry);
+    #elif defined(__linux__)
+    struct epoll_event event;
+    event.events = epollEvents(entry.interest);
+    event.data.u64 = watchToken(entry);
+    if(epoll_ctl(pollHandle, EPOLL_CTL_ADD, socket->handle, &event) == -1)
+        throw Exception(Exception::ERROR_SELECT);
+    #endif
+    socket->fitPutArea();
+    // Initializing a socket again after it was released manages it again
+    if(!server && !socket->attemptOf)
+        sockets.insert(socket);
 }
 
-std::shared_ptr<Socket> SocketManager::newMsgPackSocket() {
-    std::shared_ptr<Socket> socket(new MsgPackSocket());
-    sockets.insert(socket);
-    return socket;
+void SocketManager::unwatch(Socket* socket) {
+    Watch* entry = getWatch(socket);
+    if(!entry)
+        return;
+    #ifdef NETLINK_IO_URING
+    if(entry->armed) {
+        // Cancel the poll request right away, as it holds a reference to the socket
+        struct io_uring_sqe* sqe = ring->getSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = watchToken(*entry);
+        ring->enter();
+        entry->armed = false;
+    }
+    #elif defined(__linux__)
+    epoll_ctl(pollHandle, EPOLL_CTL_DEL, socket->handle, NULL);
+    #endif
+    timers.cancel(socket->timeoutTimer);
+    socket->timeoutTimer = 0;
+    timers.cancel(socket->shrinkTimer);
+    socket->shrinkTimer = 0;
+    timers.cancel(socket->attemptTimer);
+    socket->attemptTimer = 0;
+    // Keep the slot occupied until the end of listen, so that references to it stay valid
+    entry->generation = 0;
+    entry->interest = 0;
+    released.push_back(socket->pollSlot);
+    --watchedCount;
 }
 
-void SocketManager::listen(double waitUpToSeconds) {
-    fd_set readfds, writefds;
-    FD_ZERO(&readfds);
-    FD_ZERO(&writefds);
+void SocketManager::adopt(const std::shared_ptr<Socket>& socket) {
+    if(!socket->manager)
+        socket->manager = this;
+    if(socket->manager == this && socket->handle != -1 && !socket->resolving && !getWatch(socket.get()))
+        watch(socket, NULL);
+}
 
-    int maxHandle = -1;
-    std::set<std::shared_ptr<Socket>> selection;
-    foreach_e(sockets, iterator) {
-        Socket* socket = (*iterator).get();
-        checkSocketStillValid(sockets, iterator, socket);
+void SocketManager::abandon(const std::shared_ptr<Socket>& socket) {
+    // The resolver does not connect it anymore
+    if(socket->manager == this)
+        socket->resolving = false;
+    Watch* entry = getWatch(socket.get());
+    // Clients stay polled as long as their server is
+    if(!entry || !entry->server.expired())
+        return;
+    cancelAttempts(socket.get());
+    unwatch(socket.get());
+}
 
-        // Add the socket to the listen set
-        maxHandle = std::max(maxHandle, socket->handle);
-        FD_SET(socket->handle, &readfds);
-        selection.insert(*iterator);
+void SocketManager::releaseUnwatched(Socket* socket) {
+    try {
+        releasedUnwatched.push_back(socket->shared_from_this());
+    } catch(std::bad_weak_ptr& err) {
+        // Called by the destructor, so it is not managed anymore
+    }
+}
 
-        if(socket->type == Socket::Type::TCP_SERVER) {
-            // Iterate all TCP_SERVERS_CLIENTs
-            foreach_e(socket->clients, clientIterator) {
-                Socket* client = (*clientIterator).get();
-                checkSocketStillValid(socket->clients, clientIterator, client)
-
-                // Add client to the listen set
-                maxHandle = std::max(maxHandle, client->handle);
-                FD_SET(client->handle, &readfds);
-                FD_SET(client->handle, &writefds);
-                selection.insert(*clientIterator);
-            }
-        } else
-            FD_SET(socket->handle, &writefds);
+void SocketManager::setInterest(Watch& entry, unsigned int interest) {
+    if(entry.interest == interest)
+        return;
+    #ifdef NETLINK_IO_URING
+    if(entry.armed) {
+        // Otherwise the interest is applied when the poll request is armed again
+        struct io_uring_sqe* sqe = ring->getSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = watchToken(entry);
+        sqe->len = IORING_POLL_UPDATE_EVENTS;
+        sqe->poll32_events = epollEvents(interest);
     }
-    if(selection.empty())
+    #elif defined(__linux__)
+    struct epoll_event event;
+    event.events = epollEvents(interest);
+    event.data.u64 = watchToken(entry);
+    if(epoll_ctl(pollHandle, EPOLL_CTL_MOD, entry.socket->handle, &event) == -1)
+        throw Exception(Exception::ERROR_SELECT);
+    #endif
+    entry.interest = interest;
+}
+
+void SocketManager::updateTimeout(Socket* socket) {
+    Watch* entry = getWatch(socket);
+    if(!entry)
         return;
+    timers.cancel(socket->timeoutTimer);
+    socket->timeoutTimer = 0;
+    uint64_t expiry;
+    if(socket->status == Socket::Status::CONNECTING) {
+        if(socket->connectTimeout <= 0.0)
+            return;
+        expiry = socket->connectStart+secondsToTicks(socket->connectTimeout);
+    } else {
+        if(socket->idleTimeout <= 0.0 || socket->type == Socket::Type::TCP_SERVER)
+            return;
+        expiry = socket->lastActivity+secondsToTicks(socket->idleTimeout);
+    }
+    uint64_t token = watchToken(*entry);
+    socket->timeoutTimer = timers.schedule(expiry, [this, token]() {
+        expireTimeout(token);
+    });
+}
 
-    struct timeval timeout, *timeoutPtr = &timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
+void SocketManager::expireTimeout(uint64_t token) {
+    Watch* entry = getWatch(token);
+    if(!entry)
+        return;
+    std::shared_ptr<Socket> socket = entry->socket;
+    socket->timeoutTimer = 0;
+    Socket::Status prev = socket->getStatus();
+    if(prev != Socket::Status::CONNECTING &&
+       socket->lastActivity+secondsToTicks(socket->idleTimeout) > timers.getCurrent()) {
+        // There was activity in the meantime, postponing the timer there is cheaper than on every event
+        updateTimeout(socket.get());
+        return;
+    }
+    if(onTimeout && onTimeout(this, socket)) {
+        // Start the next periode if the socket was not disconnected by the callback, otherwise the timer expires right away again
+        if(socket->getStatus() == Socket::Status::CONNECTING)
+            socket->connectStart = timers.getCurrent();
+        else
+            socket->lastActivity = timers.getCurrent();
+        updateTimeout(socket.get());
+        return;
+    }
+    socket->disconnect();
+    if(onStatusChange && socket->getStatus() != prev)
+        onStatusChange(this, socket, prev);
+}
 
-    #ifdef WINVER
-    if(writefds.fd_count > 0)
-    #endif
-    if(select(maxHandle+1, NULL, &writefds, NULL, timeoutPtr) == -1)
-        throw Exception(Exception::ERROR_SELECT);
+void SocketManager::scheduleShrink(Socket* socket, uint64_t expiry) {
+    Watch* entry = getWatch(socket);
+    if(!entry || socket->shrinkTimer)
+        return;
+    if(expiry == 0)
+        expiry = socket->lastActivity+secondsToTicks(NETLINK_BUFFER_SHRINK_DELAY);
+    uint64_t token = watchToken(*entry);
+    socket->shrinkTimer = timers.schedule(expiry, [this, token]() {
+        expireShrink(token);
+    });
+}
 
-    foreach_e(selection, iterator) {
-        forEachSocket()
+void SocketManager::expireShrink(uint64_t token) {
+    Watch* entry = getWatch(token);
+    if(!entry)
+        return;
+    Socket* socket = entry->socket.get();
+    socket->shrinkTimer = 0;
+    uint64_t expiry = socket->lastActivity+secondsToTicks(NETLINK_BUFFER_SHRINK_DELAY);
+    if(expiry <= timers.getCurrent()) {
+        // Idle for a whole periode, try again later if the contents did not fit
+        if(!socket->shrinkBuffers())
+            return;
+        expiry = timers.getCurrent()+secondsToTicks(NETLINK_BUFFER_SHRINK_DELAY);
+    }
+    scheduleShrink(socket, expiry);
+}
 
-        if(socket->type == Socket::Type::TCP_SERVER)
+void SocketManager::scheduleAttempt(Socket* socket) {
+    Watch* entry = getWatch(socket);
+    if(!entry || socket->attemptTimer || socket->connectCandidates.empty())
+        return;
+    uint64_t token = watchToken(*entry);
+    socket->attemptTimer = timers.schedule(currentTick()+secondsToTicks(NETLINK_CONNECT_ATTEMPT_DELAY), [this, token]() {
+        Watch* entry = getWatch(token);
+        if(!entry)
+            return;
+        Socket* socket = entry->socket.get();
+        socket->attemptTimer = 0;
+        if(socket->getStatus() != Socket::Status::CONNECTING)
+            return;
+        startAttempt(socket);
+        scheduleAttempt(socket);
+    });
+}
+
+bool SocketManager::startAttempt(Socket* socket) {
+    while(!socket->connectCandidates.empty()) {
+        std::vector<Endpoint> address(1, socket->connectCandidates.front());
+        socket->connectCandidates.erase(socket->connectCandidates.begin());
+        // A plain socket which hands its handle over if it wins
+        std::shared_ptr<Socket> attempt(new Socket());
+        attempt->type = Socket::Type::TCP_CLIENT;
+        attempt->hostRemote = socket->hostRemote;
+        attempt->portRemote = socket->portRemote;
+        try {
+            attempt->openSocket(address, false);
+        } catch(Exception err) {
             continue;
+        }
+        attempt->attemptOf = socket;
+        attempt->manager = this;
+        socket->connectAttempts.push_back(attempt);
+        watch(attempt, NULL);
+        return true;
+    }
+    return false;
+}
 
-        if(FD_ISSET(socket->handle, &writefds))
-            socket->status = Socket::Status::READY;
-        else if(socket->status != Socket::Status::CONNECTING)
-            socket->status = Socket::Status::BUSY;
+void SocketManager::settleAttempt(std::shared_ptr<Socket> attempt, unsigned int events) {
+    Socket* socket = attempt->attemptOf;
+    auto& attempts = socket->connectAttempts;
+    if((events & FAILED) || attempt->takeError() != 0) {
+        // Try the next address right away
+        attempt->disconnect();
+        attempts.erase(std::find(attempts.begin(), attempts.end(), attempt));
+        timers.cancel(socket->attemptTimer);
+        socket->attemptTimer = 0;
+        startAttempt(socket);
+        scheduleAttempt(socket);
+        return;
+    }
+    if(!(events & WRITABLE))
+        return;
+    // Connected first, the others lose
+    for(const auto& other : attempts)
+        if(other != attempt)
+            other->disconnect();
+    attempts.clear();
+    socket->connectCandidates.clear();
+    unwatch(socket);
+    unwatch(attempt.get());
+    socket->replaceHandle(attempt.get());
+    // Reports the connect in the next listen
+    watch(socket->shared_from_this(), NULL);
+}
 
-        if(onStatusChange && socket->status != prev)
-            onStatusChange(this, *iterator, prev);
-        checkSocketStillValid(sockets, iterator, socket)
+void SocketManager::failover(const std::shared_ptr<Socket>& socket) {
+    unwatch(socket.get());
+    auto& attempts = socket->connectAttempts;
+    try {
+        if(!attempts.empty()) {
+            std::shared_ptr<Socket> attempt = attempts.front();
+            attempts.erase(attempts.begin());
+            unwatch(attempt.get());
+            socket->replaceHandle(attempt.get());
+        } else
+            socket->replaceHandle(NULL);
+    } catch(Exception err) {
+        return;
+    }
+    watch(socket, NULL);
+}
 
-        // Try to send data of MsgPack queue in socket
-        if(socket->status != Socket::Status::READY)
-            continue;
+void SocketManager::cancelAttempts(Socket* socket) {
+    timers.cancel(socket->attemptTimer);
+    socket->attemptTimer = 0;
+    socket->connectCandidates.clear();
+    std::vector<std::shared_ptr<Socket>> attempts;
+    attempts.swap(socket->connectAttempts);
+    for(const auto& attempt : attempts)
+        attempt->disconnect();
+}
 
-        if(msgPackSocket)
-            while(msgPackSocket->queue.size()) {
-                std::unique_ptr<MsgPack::Element>& element = msgPackSocket->queue.front();
-                msgPackSocket->serializer << element;
-                if(element)
-                    break;
-                msgPackSocket->queue.pop();
-            }
-        socket->pubsync();
+void SocketManager::armPoll(Watch& entry) {
+    #ifdef NETLINK_IO_URING
+    struct io_uring_sqe* sqe = ring->getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = entry.socket->handle;
+    sqe->poll32_events = epollEvents(entry.interest);
+    sqe->user_data = watchToken(entry);
+    entry.armed = true;
+    #else
+    (void)entry;
+    #endif
+}
+
+void SocketManager::flush(const std::shared_ptr<Socket>& socket) {
+    if(socket->type == Socket::Type::TCP_SERVER)
+        return;
+    if(socket->status == Socket::Status::READY) {
+        bool sending = socket->hasPendingOutput();
+        socket->onWritable();
+        // Sending postpones the idle timeout too, unless the socket was blocked right away
+        if(sending && (socket->status == Socket::Status::READY || !socket->hasPendingOutput()))
+            socket->lastActivity = currentTick();
     }
-    if(selection.empty())
+    socket->returnIdleBuffers();
+    // The next write schedules the next flush
+    socket->fitPutArea();
+    // Only poll for writability as long as there is something left to send or a send would block
+    Watch* entry = getWatch(socket.get());
+    if(!entry)
+        return;
+    bool writable = socket->status == Socket::Status::CONNECTING || socket->status == Socket::Status::BUSY || socket->hasPendingOutput();
+    setInterest(*entry, ((socket->receivePaused) ? 0 : READABLE) | ((writable) ? WRITABLE : 0));
+}
+
+void SocketManager::markPending(Socket* socket) {
+    Watch* entry = getWatch(socket);
+    if(!entry)
         return;
+    socket->flushScheduled = true;
+    pending.push_back(watchToken(*entry));
+}
 
+void SocketManager::pauseReceiving(Socket* socket, bool paused) {
+    socket->receivePaused = paused;
+    Watch* entry = getWatch(socket);
+    if(entry)
+        setInterest(*entry, (entry->interest & ~READABLE) | ((paused) ? 0 : READABLE));
+}
+
+void SocketManager::releaseSockets() {
+    for(uint32_t slot : released) {
+        Watch& entry = watched[slot];
+        // Socket might have been initialized again in the meantime
+        if(entry.socket->getStatus() == Socket::Status::NOT_CONNECTED) {
+            // The server might have been freed before its clients, then there is no set left to remove them from
+            std::shared_ptr<Socket> server = entry.server.lock();
+            if(server)
+                server->clients.erase(entry.socket);
+            else
+                sockets.erase(entry.socket);
+        }
+        entry.socket.reset();
+        entry.server.reset();
+        freeSlots.push_back(slot);
+    }
+    released.clear();
+    for(const auto& socket : releasedUnwatched)
+        if(socket->getStatus() == Socket::Status::NOT_CONNECTED && socket->manager == this)
+            sockets.erase(socket);
+    releasedUnwatched.clear();
+}
+
+void SocketManager::poll(double waitUpToSeconds, std::vector<std::pair<uint64_t, unsigned int>>& events) {
+    #ifdef NETLINK_IO_URING
+    // Poll requests are one shot and only armed again here, after the last events were handled,
+    // so that they do not report readiness which was consumed in the meantime
+    for(uint64_t token : disarmed) {
+        Watch* entry = getWatch(token);
+        if(entry && !entry->armed)
+            armPoll(*entry);
+    }
+    disarmed.clear();
+    if(!wakeupArmed) {
+        struct io_uring_sqe* sqe = ring->getSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = resolver.getWakeupHandle();
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = wakeupToken;
+        wakeupArmed = true;
+    }
+    // Submit all interest changes and wait in one go
+    ring->enter(waitUpToSeconds);
+    ring->complete([this, &events](uint64_t userData, int32_t result, uint32_t /* flags */) {
+        if(userData == 0) // Completion of a remove or update request
+            return;
+        if(userData == wakeupToken) { // The resolver is read in listen
+            wakeupArmed = false;
+            return;
+        }
+        Watch* entry = getWatch(userData);
+        if(!entry)
+            return;
+        entry->armed = false;
+        disarmed.push_back(userData);
+        if(result == -ECANCELED)
+            return;
+        unsigned int interest = 0;
+        if(result < 0 || (result & (POLLIN | EPOLLRDHUP | POLLERR | POLLHUP)))
+            interest |= READABLE;
+        if(result > 0 && (result & POLLOUT))
+            interest |= WRITABLE;
+        if(result < 0 || (result & (POLLERR | POLLHUP)))
+            interest |= FAILED;
+        events.push_back(std::make_pair(userData, interest));
+    });
+    #elif defined(__linux__)
+    struct epoll_event ready[NETLINK_MAX_POLL_EVENTS];
+    int timeout = (waitUpToSeconds < 0.0) ? -1 : static_cast<int>(std::ceil(waitUpToSeconds*1000.0));
+    int count = epoll_wait(pollHandle, ready, NETLINK_MAX_POLL_EVENTS, timeout);
+    if(count == -1) {
+        if(errno == EINTR)
+            return;
+        throw Exception(Exception::ERROR_SELECT);
+    }
+    for(int i = 0; i < count; ++i) {
+        if(ready[i].data.u64 == wakeupToken) // The resolver is read in listen
+            continue;
+        unsigned int flags = 0;
+        if(ready[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+            flags |= READABLE;
+        if(ready[i].events & EPOLLOUT)
+            flags |= WRITABLE;
+        if(ready[i].events & (EPOLLERR | EPOLLHUP))
+            flags |= FAILED;
+        events.push_back(std::make_pair(static_cast<uint64_t>(ready[i].data.u64), flags));
+    }
+    #else
+    fd_set readfds, writefds, exceptfds;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&exceptfds);
+
+    int maxHandle = -1;
+    for(const auto& entry : watched) {
+        if(entry.generation == 0)
+            continue;
+        int handle = entry.socket->handle;
+        maxHandle = std::max(maxHandle, handle);
+        if(entry.interest & READABLE)
+            FD_SET(handle, &readfds);
+        if(entry.interest & WRITABLE)
+            FD_SET(handle, &writefds);
+        // Windows reports failed nonblocking connects as exception
+        if(entry.socket->status == Socket::Status::CONNECTING)
+            FD_SET(handle, &exceptfds);
+    }
+
+    struct timeval timeout, *timeoutPtr = &timeout;
     if(waitUpToSeconds >= 0.0) {
         timeout.tv_sec = waitUpToSeconds;
         timeout.tv_usec = fmod(waitUpToSeconds, 1.0) * 1000000.0;
     } else
         timeoutPtr = NULL;
 
-    if(select(maxHandle+1, &readfds, NULL, NULL, timeoutPtr) == -1)
+    if(select(maxHandle+1, &readfds, &writefds, &exceptfds, timeoutPtr) == -1)
         throw Exception(Exception::ERROR_SELECT);
 
-    foreach_e(selection, iterator) {
-        forEachSocket()
+    for(const auto& entry : watched) {
+        if(entry.generation == 0)
+            continue;
+        unsigned int flags = 0;
+        if(FD_ISSET(entry.socket->handle, &readfds))
+            flags |= READABLE;
+        if(FD_ISSET(entry.socket->handle, &writefds))
+            flags |= WRITABLE;
+        if(FD_ISSET(entry.socket->handle, &exceptfds))
+            flags |= READABLE | FAILED;
+        if(flags)
+            events.push_back(std::make_pair(watchToken(entry), flags));
+    }
+    #endif
+}
+
+std::shared_ptr<Socket> SocketManager::newMsgPackSocket() {
+    return newSocket<MsgPackSocket>();
+}
+
+uint64_t SocketManager::setTimer(double seconds, std::function<void(SocketManager* manager)> callback) {
+    return timers.schedule(currentTick()+secondsToTicks(seconds), [this, callback]() {
+        callback(this);
+    });
+}
+
+bool SocketManager::cancelTimer(uint64_t timer) {
+    return timers.cancel(timer);
+}
+
+void SocketManager::listen(double waitUpToSeconds) {
+    releaseSockets();
+    if(watchedCount == 0 && !resolver.isPending()) {
+        timers.advance(currentTick());
+        releaseSockets();
+        return;
+    }
 
-        if(!FD_ISSET(socket->handle, &readfds))
+    // Send the output of all sockets which got new data since the last listen
+    std::vector<uint64_t> flushing;
+    flushing.swap(pending);
+    for(uint64_t token : flushing) {
+        Watch* entry = getWatch(token);
+        if(!entry)
+            continue;
+        const std::shared_ptr<Socket>& socket = entry->socket;
+        socket->flushScheduled = false;
+        Socket::Status prev = socket->getStatus();
+        flush(socket);
+        if(onStatusChange && socket->getStatus() != prev)
+            onStatusChange(this, socket, prev);
+    }
+    // Reuse the capacity for the next listen
+    flushing.clear();
+    if(pending.empty())
+        pending.swap(flushing);
+
+    // Do not wait beyond the next expiring timer
+    if(!timers.empty()) {
+        uint64_t now = currentTick(), expiry = timers.nextExpiry();
+        double untilExpiry = (expiry > now) ? (expiry-now)/1000.0 : 0.0;
+        if(waitUpToSeconds < 0.0 || untilExpiry < waitUpToSeconds)
+            waitUpToSeconds = untilExpiry;
+    }
+    #ifndef __linux__
+    // There is no wakeup handle, look for resolved hosts regularly
+    if(resolver.isPending() && (waitUpToSeconds < 0.0 || waitUpToSeconds > NETLINK_RESOLVER_POLL_INTERVAL))
+        waitUpToSeconds = NETLINK_RESOLVER_POLL_INTERVAL;
+    #endif
+
+    std::vector<std::pair<uint64_t, unsigned int>> events;
+    events.swap(readyEvents);
+    poll(waitUpToSeconds, events);
+    uint64_t now = currentTick();
+
+    for(const auto& event : events) {
+        Watch* entry = getWatch(event.first);
+        if(!entry)
+            continue;
+        // Slots are only reused after releaseSockets(), so this reference stays valid
+        const std::shared_ptr<Socket>& socket = entry->socket;
+        socket->lastActivity = now;
+        Socket::Status prev = socket->getStatus();
+        // The error queue also signals completed zero copy sends
+        if((event.second & FAILED) && socket->zeroCopySent != socket->zeroCopyCompleted)
+            socket->readZeroCopyCompletions();
+        if(socket->attemptOf) {
+            settleAttempt(socket, event.second);
+            continue;
+        }
+        if(prev == Socket::Status::CONNECTING && (event.second & (WRITABLE | FAILED)) &&
+           (!socket->connectAttempts.empty() || !socket->connectCandidates.empty()) &&
+           ((event.second & FAILED) || socket->takeError() != 0)) {
+            // Another attempt or address takes over the connect
+            failover(socket);
+            if(onStatusChange && socket->getStatus() != prev)
+                onStatusChange(this, socket, prev);
+            continue;
+        }
+        // Only ask for the error if the poller reported one or a nonblocking connect finished
+        if((event.second & FAILED) || (prev == Socket::Status::CONNECTING && (event.second & WRITABLE)))
+            socket->disconnectOnError();
+        if(socket->getStatus() == Socket::Status::NOT_CONNECTED) {
+            if(onStatusChange)
+                onStatusChange(this, socket, prev);
+            continue;
+        }
+        if(event.second & WRITABLE) {
+            // Connected or able to send again
+            socket->status = Socket::Status::READY;
+            if(prev == Socket::Status::CONNECTING) {
+                socket->connectStart = 0;
+                cancelAttempts(socket.get());
+                updateTimeout(socket.get());
+            }
+            if(onStatusChange && socket->status != prev)
+                onStatusChange(this, socket, prev);
+            prev = socket->getStatus();
+            if(prev == Socket::Status::NOT_CONNECTED)
+                continue;
+            flush(socket);
+            if(onStatusChange && socket->getStatus() != prev)
+                onStatusChange(this, socket, prev);
+            prev = socket->getStatus();
+            if(prev == Socket::Status::NOT_CONNECTED)
+                continue;
+        }
+
+        if(!(event.second & READABLE))
             continue;
 
         if(socket->type == Socket::Type::TCP_SERVER) {
-            // Server got a new client
-            std::shared_ptr<Socket> newSocket = socket->accept();
-            if(onConnectRequest && !onConnectRequest(this, *iterator, newSocket)) {
-                newSocket->disconnect();
-                socket->clients.erase(newSocket);
+            // Server got new clients, drain the backlog until it is empty or the batch is full
+            for(unsigned int i = 0; i < acceptBatchSize && socket->getStatus() == Socket::Status::LISTENING; ++i) {
+                std::shared_ptr<Socket> newSocket = socket->accept();
+                if(!newSocket)
+                    break;
+                if(onConnectRequest && !onConnectRequest(this, socket, newSocket)) {
+                    newSocket->disconnect();
+                    socket->clients.erase(newSocket);
+                }
             }
         } else {
-            // Can not read: disconnect
-            if(socket->showmanyc() <= 0) {
+            // Read into the input buffer right away, a closed connection can not be read from
+            std::streamsize received;
+            bool batched = (socket->datagramBatchSize > 1 || socket->receiveOffload) && socket->getInputBufferSize();
+            try {
+                if(batched) // Receives and passes on several datagrams at once
+                    received = socket->receiveDatagrams();
+                else if(socket->getInputBufferSize()) {
+                    std::streamsize buffered = (socket->type == Socket::Type::UDP_PEER) ? 0 : socket->egptr()-socket->gptr();
+                    received = socket->advanceInputBuffer()-buffered;
+                } else // Unbuffered sockets are read by the callbacks
+                    received = (socket->showmanyc() > 0) ? 1 : -1;
+            } catch(Exception err) {
+                received = -1;
+            }
+            if(received < 0) {
                 socket->disconnect();
-                removeSocket()
+                if(onStatusChange)
+                    onStatusChange(this, socket, prev);
+                continue;
             }
-
-            // Ensure that we only read data from the incoming packet (UDP)
-            if(socket->type == Socket::Type::UDP_PEER)
-                socket->advanceInputBuffer();
-            // Received new data
-            if(msgPackSocket && onReceiveMsgPack) {
-                std::unique_ptr<MsgPack::Element> element;
-                while(true) {
-                    msgPackSocket->deserializer >> element;
-                    if(!element)
-                        break;
-                    onReceiveMsgPack(this, *iterator, std::move(element));
-                }
-            } else if(onReceiveRaw)
-                onReceiveRaw(this, *iterator);
-            checkSocketStillValid(sockets, iterator, socket)
+            // Received new data, otherwise it was a spurious wakeup
+            if(!batched && (received > 0 || socket->egptr() != socket->gptr()))
+                socket->onReadable();
+            socket->returnIdleBuffers();
         }
     }
+    events.clear();
+    readyEvents.swap(events);
+    // Connects sockets whose hosts were resolved
+    resolver.complete();
+    timers.advance(now);
+    releaseSockets();
 }
 
 };
@@ -0,0 +1,79 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "netLink.h"
+
+namespace netLink {
+
+SocketManagerGroup::SocketManagerGroup(unsigned count) :running(false) {
+    for(count = std::max(count, 1U); count > 0; --count)
+        managers.push_back(std::unique_ptr<SocketManager>(new SocketManager()));
+}
+
+SocketManagerGroup::~SocketManagerGroup() {
+    try {
+        stop();
+    } catch(...) {
+        // A destructor must not throw, so the exceptions of the threads are dropped
+    }
+}
+
+std::vector<std::shared_ptr<Socket>> SocketManagerGroup::initAsTcpServers(const std::string& hostLocal, unsigned portLocal, bool msgPack, unsigned listenQueue) {
+    std::vector<std::shared_ptr<Socket>> servers;
+    for(const auto& manager : managers) {
+        std::shared_ptr<Socket> server = (msgPack) ? manager->newMsgPackSocket() : manager->newSocket();
+        // The first server determines the port if it is choosen by the system
+        server->initAsTcpServer(hostLocal, (servers.empty()) ? portLocal : servers[0]->portLocal, listenQueue);
+        servers.push_back(server);
+    }
+    return servers;
+}
+
+void SocketManagerGroup::start(double waitUpToSeconds) {
+    if(running.exchange(true))
+        return;
+    errors.assign(managers.size(), nullptr);
+    for(size_t i = 0; i < managers.size(); ++i) {
+        SocketManager* reactor = managers[i].get();
+        std::exception_ptr* error = &errors[i];
+        threads.push_back(std::thread([this, reactor, error, waitUpToSeconds]() {
+            while(running)
+                try {
+                    reactor->listen(waitUpToSeconds);
+                } catch(...) {
+                    // Otherwise it would terminate the process, stop() reports it
+                    if(!*error)
+                        *error = std::current_exception();
+                }
+        }));
+    }
+}
+
+void SocketManagerGroup::stop() {
+    running = false;
+    for(auto& thread : threads)
+        thread.join();
+    threads.clear();
+    std::vector<std::exception_ptr> caught;
+    caught.swap(errors);
+    for(const auto& error : caught)
+        if(error)
+            std::rethrow_exception(error);
+}
+
+};
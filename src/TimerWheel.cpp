@@ -0,0 +1,168 @@
+/*
+    netLink: c++ 11 networking library
+    Copyright (C) 2013-2023 Alexander Meißner
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TimerWheel.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static int countTrailingZeros(uint64_t value) {
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+}
+static int highestBit(uint64_t value) {
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+}
+#else
+#define countTrailingZeros(value) __builtin_ctzll(value)
+#define highestBit(value) (63-__builtin_clzll(value))
+#endif
+
+#define LEVEL_BITS 6
+#define EXPIRED_LIST (NETLINK_TIMER_WHEEL_LEVELS*NETLINK_TIMER_WHEEL_SLOTS)
+#define NO_TIMER UINT32_MAX
+
+namespace netLink {
+
+TimerWheel::TimerWheel(uint64_t now) :current(now), generation(0), count(0) {
+    for(auto& list : lists)
+        list = NO_TIMER;
+    for(auto& bitmap : occupied)
+        bitmap = 0;
+}
+
+void TimerWheel::link(uint32_t index) {
+    Timer& timer = timers[index];
+    uint32_t list;
+    if(timer.expiry <= current)
+        list = EXPIRED_LIST;
+    else {
+        // The level is determined by the highest digit in which expiry and current differ
+        unsigned int level = highestBit(timer.expiry ^ current) / LEVEL_BITS;
+        uint32_t slot = (timer.expiry >> (level*LEVEL_BITS)) & (NETLINK_TIMER_WHEEL_SLOTS-1);
+        list = level*NETLINK_TIMER_WHEEL_SLOTS+slot;
+        occupied[level] |= 1ULL << slot;
+    }
+    timer.list = list;
+    timer.prev = NO_TIMER;
+    timer.next = lists[list];
+    if(timer.next != NO_TIMER)
+        timers[timer.next].prev = index;
+    lists[list] = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Timer& timer = timers[index];
+    if(timer.prev != NO_TIMER)
+        timers[timer.prev].next = timer.next;
+    else {
+        lists[timer.list] = timer.next;
+        if(timer.next == NO_TIMER && timer.list != EXPIRED_LIST)
+            occupied[timer.list/NETLINK_TIMER_WHEEL_SLOTS] &= ~(1ULL << (timer.list%NETLINK_TIMER_WHEEL_SLOTS));
+    }
+    if(timer.next != NO_TIMER)
+        timers[timer.next].prev = timer.prev;
+}
+
+uint64_t TimerWheel::schedule(uint64_t expiry, Callback callback) {
+    uint32_t index;
+    if(freeTimers.empty()) {
+        index = timers.size();
+        timers.push_back(Timer());
+    } else {
+        index = freeTimers.back();
+        freeTimers.pop_back();
+    }
+    if(++generation == 0) // Generation 0 marks free slots
+        ++generation;
+    Timer& timer = timers[index];
+    timer.expiry = expiry;
+    timer.generation = generation;
+    timer.callback = std::move(callback);
+    link(index);
+    ++count;
+    return (static_cast<uint64_t>(generation) << 32) | index;
+}
+
+bool TimerWheel::cancel(uint64_t id) {
+    uint32_t index = static_cast<uint32_t>(id);
+    if(id == 0 || index >= timers.size() || timers[index].generation != (id >> 32))
+        return false;
+    unlink(index);
+    timers[index].generation = 0;
+    timers[index].callback = nullptr;
+    freeTimers.push_back(index);
+    --count;
+    return true;
+}
+
+uint64_t TimerWheel::nextExpiry() const {
+    if(lists[EXPIRED_LIST] != NO_TIMER)
+        return current;
+    // Timers of a level always expire before the ones of the levels above
+    for(unsigned int level = 0; level < NETLINK_TIMER_WHEEL_LEVELS; ++level) {
+        if(!occupied[level])
+            continue;
+        unsigned int shift = level*LEVEL_BITS,
+                     digit = (current >> shift) & (NETLINK_TIMER_WHEEL_SLOTS-1);
+        // Slots of a level are always ahead of the digit of current
+        uint64_t ahead = occupied[level] & ~((2ULL << digit)-1),
+                 window = (shift+LEVEL_BITS < 64) ? (current >> (shift+LEVEL_BITS)) << (shift+LEVEL_BITS) : 0;
+        return window | (static_cast<uint64_t>(countTrailingZeros(ahead)) << shift);
+    }
+    return UINT64_MAX;
+}
+
+void TimerWheel::advance(uint64_t now) {
+    if(now < current)
+        return;
+    // Collect the timers of all slots which were passed
+    passed.clear();
+    for(unsigned int level = 0; level < NETLINK_TIMER_WHEEL_LEVELS; ++level) {
+        unsigned int shift = level*LEVEL_BITS;
+        uint64_t from = current >> shift, to = now >> shift;
+        if(from == to)
+            break;
+        uint64_t steps = std::min(to-from, static_cast<uint64_t>(NETLINK_TIMER_WHEEL_SLOTS));
+        for(uint64_t step = 1; step <= steps; ++step) {
+            uint32_t list = level*NETLINK_TIMER_WHEEL_SLOTS+((from+step) & (NETLINK_TIMER_WHEEL_SLOTS-1));
+            for(uint32_t index = lists[list]; index != NO_TIMER; index = timers[index].next)
+                passed.push_back(index);
+            lists[list] = NO_TIMER;
+            occupied[level] &= ~(1ULL << (list%NETLINK_TIMER_WHEEL_SLOTS));
+        }
+    }
+    current = now;
+    // Expired timers go into the expired list, the others move down to a lower level
+    for(uint32_t index : passed)
+        link(index);
+    // Fire expired timers, callbacks might schedule or cancel other timers
+    while(lists[EXPIRED_LIST] != NO_TIMER) {
+        uint32_t index = lists[EXPIRED_LIST];
+        unlink(index);
+        Callback callback = std::move(timers[index].callback);
+        timers[index].generation = 0;
+        freeTimers.push_back(index);
+        --count;
+        callback();
+    }
+}
+
+};